@@ -52,7 +52,8 @@ int main(int argc, char** argv)
 		VM.register_set(11, virt_addr); // a1 = argv
 
 		//beware, this could block on reading stdin - if that's what the guest program does
-		//  put it on another thread if that's not OK
+		//  put it on another thread if that's not OK, or map a Pipe and run it under a Scheduler
+		//  (see TinySchedulerRISCV64.h), which parks it until there's input
 		VM.execute_program(entry_point,100*1024UL*1024);
 		return VM.register_get(10);
 	}
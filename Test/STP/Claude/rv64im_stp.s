@@ -1523,6 +1523,59 @@ CSRRWI x30, cycle, 0
 ADDI sp, sp, -8
 SD x0, 0(sp)
 
+# ============================================================================
+# FUSED IDIOMS
+# ============================================================================
+# Note: The predecoding engines run these sequences as single fused ops
+
+# TEST: Jump into the second slot of a fused rotate
+# CONTEXT: SLLI/SRLI/OR fuse into one op; entering at the SRLI runs only the SRLI and OR
+# EXPECTED PUSH: 0x0000000000000A12
+ADDI x5, x0, 0x123
+ADDI x6, x0, 0xA0
+SLLI x6, x6, 4          # x6 = 0xA00, kept since the SLLI is skipped
+JAL x0, rot_mid
+rot_full:
+SLLI x6, x5, 60
+rot_mid:
+SRLI x7, x5, 4          # x7 = 0x12
+OR x8, x6, x7           # x8 = 0xA12
+ADDI sp, sp, -8
+SD x8, 0(sp)
+
+# TEST: Jump into the third slot of a fused rotate
+# CONTEXT: Entering at the OR runs only the OR, on the values set before the jump
+# EXPECTED PUSH: 0x0000000000000AB0
+ADDI x6, x0, 0xA0
+SLLI x6, x6, 4          # x6 = 0xA00
+ADDI x7, x0, 0xB0       # x7 = 0xB0
+JAL x0, rot_last
+SLLI x6, x5, 60
+SRLI x7, x5, 4
+rot_last:
+OR x8, x6, x7           # x8 = 0xAB0
+ADDI sp, sp, -8
+SD x8, 0(sp)
+
+# TEST: Store into a fused pair
+# CONTEXT: The second pass runs the SRLI the first pass wrote over the second op of a SLLI/SRLI pair
+# EXPECTED PUSH: 0x00000000000005FA
+ADDI x5, x0, 0x5A
+ADDI x10, x0, 0
+ADDI x9, x0, 2
+AUIPC x28, 0            # x28 = address of this instruction
+patch_loop:
+SLLI x6, x5, 8          # x6 = 0x5A00
+SRLI x7, x6, 4          # pass 1: x7 = 0x5A0, then overwritten with SRLI x7, x6, 8
+ADD x10, x10, x7
+LUI x29, 0x835
+ADDI x29, x29, 0x393    # x29 = 0x00835393, SRLI x7, x6, 8
+SW x29, 8(x28)
+ADDI x9, x9, -1
+BNE x9, x0, patch_loop  # pass 2: x7 = 0x5A, x10 = 0x5A0 + 0x5A = 0x5FA
+ADDI sp, sp, -8
+SD x10, 0(sp)
+
 # TEST: Final sentinel with complement pattern
 # CONTEXT: Different pattern from first sentinel
 # EXPECTED PUSH: 0xAAAAAAAAAAAAAAAA
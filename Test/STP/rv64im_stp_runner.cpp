@@ -45,28 +45,6 @@ int main(int argc, char** argv)
 	const char* bin_file = argv[2];
 	bool print_all = (argc > 3 && std::string(argv[3]) == "all");
 
-	std::deque<uint64_t> stack_values;
-	try
-	{
-		// Create VM with a modest stack (4 KiB)
-		TinyRISCV64::VM vm(4096);
-		vm.program_load(bin_file);
-
-		//save the stack pointer
-		auto sp_before = vm.register_get(2);
-
-		vm.execute_program();
-
-		//dump the stack
-		while (vm.register_get(2) < sp_before)
-			stack_values.push_front(vm.stack_pop<uint64_t>());
-	}
-	catch (const std::exception &e)
-	{
-		std::fprintf(stderr, "VM Exception: %s\n", e.what());
-		return 1;
-	}
-
 	//Read and parse the ASM file into a std::vector<std::pair<std::string,uint64_t>>
 	//Each std::pair is a TEST block from the asm, paired with the expected push value from the block
 
@@ -93,32 +71,89 @@ int main(int argc, char** argv)
 		test_cases.emplace_back(block, expected_value);
 	}
 
-	//Compare results
-	int passed = 0;
+	//Run the STP on every execution engine and memory backing
 	int failed = 0;
-
-	for (size_t i = 0; i < test_cases.size() && i < stack_values.size(); ++i)
+	for (const auto& [memory_name, memory] : TinyRISCV64::memory_names)
+	for (const auto& [engine_name, engine] : TinyRISCV64::engine_names)
 	{
-		uint64_t expected = test_cases[i].second;
-		uint64_t actual = stack_values[i];
-		bool pass = (expected == actual);
+		std::deque<uint64_t> stack_values;
+		try
+		{
+			// Create VM with a modest stack (4 KiB)
+			TinyRISCV64::VM vm(4096, 1024UL*1024, engine);
+			vm.set_memory(memory);
+			vm.program_load(bin_file);
+
+			//save the stack pointer
+			auto sp_before = vm.register_get(2);
+
+			vm.execute_program();
+
+			//dump the stack
+			while (vm.register_get(2) < sp_before)
+				stack_values.push_front(vm.stack_pop<uint64_t>());
+
+			//then again a step of one or two instructions at a time, so the fuel runs out inside every fused op:
+			//each step must retire exactly its fuel, and the whole run the same count and stack
+			const size_t retired = vm.retired_count();
+			for (const size_t fuel : {1, 2})
+			{
+				vm.program_load(bin_file);
+				vm.start_program();
+				size_t stepped = 0;
+				TinyRISCV64::RunStatus status;
+				while ((status = vm.run(fuel)) == TinyRISCV64::RunStatus::FuelExhausted)
+				{
+					if (vm.retired_count() != fuel)
+						throw std::runtime_error("Step of " + std::to_string(fuel) + " retired " + std::to_string(vm.retired_count()));
+					stepped += fuel;
+				}
+				if (status != TinyRISCV64::RunStatus::Halted)
+					throw std::runtime_error("Stepped run stopped: " + vm.trap_reason());
+				stepped += vm.retired_count();
+
+				std::deque<uint64_t> stepped_values;
+				while (vm.register_get(2) < sp_before)
+					stepped_values.push_front(vm.stack_pop<uint64_t>());
+				if (stepped != retired || stepped_values != stack_values)
+					throw std::runtime_error("Steps of " + std::to_string(fuel) + " retired " + std::to_string(stepped)
+						+ " of " + std::to_string(retired) + " instructions, or pushed other values");
+			}
+		}
+		catch (const std::exception &e)
+		{
+			std::fprintf(stderr, "VM Exception (%s engine, %s memory): %s\n", engine_name, memory_name, e.what());
+			return 1;
+		}
 
-		if (pass)
-			passed++;
-		else
-			failed++;
+		//Compare results
+		int engine_passed = 0;
+		int engine_failed = 0;
 
-		if (!pass || print_all)
+		for (size_t i = 0; i < test_cases.size() && i < stack_values.size(); ++i)
 		{
-			std::printf("%s Test %zu:\n", pass ? "PASS" : "FAIL", i + 1);
-			std::printf("Expected: 0x%016" PRIX64 "\n", expected);
-			std::printf("Actual:   0x%016" PRIX64 "\n", actual);
-			std::printf("%s\n", test_cases[i].first.c_str());
-			std::printf("\n");
+			uint64_t expected = test_cases[i].second;
+			uint64_t actual = stack_values[i];
+			bool pass = (expected == actual);
+
+			if (pass)
+				engine_passed++;
+			else
+				engine_failed++;
+
+			if (!pass || print_all)
+			{
+				std::printf("%s Test %zu (%s engine, %s memory):\n", pass ? "PASS" : "FAIL", i + 1, engine_name, memory_name);
+				std::printf("Expected: 0x%016" PRIX64 "\n", expected);
+				std::printf("Actual:   0x%016" PRIX64 "\n", actual);
+				std::printf("%s\n", test_cases[i].first.c_str());
+				std::printf("\n");
+			}
 		}
-	}
 
-	std::printf("Passed: %d, Failed: %d\n", passed, failed);
+		std::printf("%s engine, %s memory - Passed: %d, Failed: %d\n", engine_name, memory_name, engine_passed, engine_failed);
+		failed += engine_failed;
+	}
 
 	//return the number of failed tests
 	return failed;
@@ -0,0 +1,119 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Neil Stephens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+
+#include "sha512sum_aot.h" // Generated from Test/stress/sha512sumO2 by rv64im_aot
+
+extern "C"
+{
+#define NO_SHA512SUM_MAIN
+#include "../stress/sha512.c"
+#undef NO_SHA512SUM_MAIN
+}
+
+// Run a sha512sum VM over data_file, returning its output or the error it raised
+template<typename SomeVM>
+std::string run_sha512sum(SomeVM& vm, const char* elf_file, const char* data_file, const size_t max_instructions)
+{
+	try
+	{
+		const auto entry_point = vm.program_load(elf_file);
+		auto pDataStream = std::make_shared<std::fstream>(data_file,std::ios::in | std::ios::binary);
+		if (!pDataStream || pDataStream->fail())
+			throw std::invalid_argument("Failed to open data file: " + std::string(data_file));
+		auto pOutStream = std::make_shared<std::stringstream>();
+		vm.map_fd(0,pDataStream);
+		vm.map_fd(1,pOutStream);
+		vm.map_fd(2,std::make_shared<std::stringstream>());
+
+		vm.execute_program(entry_point,max_instructions);
+		std::string vm_output;
+		*pOutStream >> vm_output;
+		return vm_output;
+	}
+	catch (const std::exception &e)
+	{
+		return std::string("error: ") + e.what();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::fprintf(stderr, "Usage: %s <sha512sumO2_elf> <data_file>\n", argv[0]);
+		return 1;
+	}
+	const char* elf_file = argv[1];
+	const char* data_file = argv[2];
+
+	//Native result
+	std::ifstream fin(data_file, std::ios::binary);
+	char buf[1024];
+	struct sha512 sha;
+	sha512_init(&sha);
+	do
+	{
+		fin.read(buf, sizeof(buf));
+		sha512_append(&sha, buf, fin.gcount());
+	}while(fin.gcount() > 0);
+	char sha_hex[SHA512_HEX_SIZE];
+	sha512_finalize_hex(&sha, sha_hex);
+	const std::string native_output(sha_hex);
+
+	int ret = 0;
+	for (const size_t max_instructions : {100UL*1024*1024, 1000UL, 12345UL})
+	{
+		TinyRISCV64::ElfVM vm;
+		sha512sum_aot aot_vm;
+
+		auto start = std::chrono::steady_clock::now();
+		const auto vm_output = run_sha512sum(vm, elf_file, data_file, max_instructions);
+		const std::chrono::duration<double> vm_time = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		const auto aot_output = run_sha512sum(aot_vm, elf_file, data_file, max_instructions);
+		const std::chrono::duration<double> aot_time = std::chrono::steady_clock::now() - start;
+
+		std::printf("max %zu instructions: Interpreter %.3fs, AOT %.3fs\n", max_instructions, vm_time.count(), aot_time.count());
+		if (aot_output != vm_output)
+		{
+			std::fprintf(stderr, "error: AOT output '%s' != Interpreter output '%s'\n", aot_output.c_str(), vm_output.c_str());
+			ret = 1;
+		}
+		else if (max_instructions > 1000000 && aot_output != native_output)
+		{
+			std::fprintf(stderr, "error: AOT output '%s' != native output '%s'\n", aot_output.c_str(), native_output.c_str());
+			ret = 1;
+		}
+	}
+	if (!ret)
+		std::printf("PASS\n");
+	return ret;
+}
@@ -0,0 +1,219 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Neil Stephens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Ahead-of-time translator: RV64IM ELF -> C++ header
+//
+//   rv64im_aot <elf_file> <output_header> [class_name]
+//
+// The header defines class_name, an ElfVM whose execute_program() runs each basic block
+// of the ELF as straight-line native code built from the same ops the VM engines use.
+// Jumps to addresses that were not found statically (and ECALL/EBREAK/CSR instructions)
+// are run by the interpreter, so the translation behaves exactly like ElfVM.
+//
+// The translated program text must not be modified at run time.
+
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../../TinyElfRISCV64.h"
+
+using namespace TinyRISCV64;
+
+// Exposes the ELF loader and decoder
+struct Translator : ElfVM
+{
+	using ElfVM::load_elf;
+	using VM::decode;
+	using VM::ends_block;
+	using VM::Op;
+	using VM::DecodedOp;
+};
+using Op = Translator::Op;
+
+static const char* op_name(const Op op)
+{
+	static constexpr const char* names[] = {
+		#define TINYRISCV64_OP_NAME(name) #name,
+		TINYRISCV64_OPS(TINYRISCV64_OP_NAME)
+		#undef TINYRISCV64_OP_NAME
+	};
+	return names[static_cast<u8>(op)];
+}
+
+// Hash of the translated part of the image, checked when the ELF is loaded
+static u64 fnv1a(const u8* const bytes, const size_t len)
+{
+	u64 h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; ++i)
+		h = (h ^ bytes[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+static std::string imm_literal(const i64 imm)
+{
+	if (imm >= INT32_MIN && imm <= INT32_MAX)
+		return std::to_string(imm);
+	return std::format("static_cast<i64>(0x{:x}ULL)", static_cast<u64>(imm));
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::fprintf(stderr, "Usage: %s <elf_file> <output_header> [class_name]\n", argv[0]);
+		return 1;
+	}
+	const std::string class_name = argc > 3 ? argv[3] : "TranslatedVM";
+
+	try
+	{
+		const auto [image, base, entry, tls, ro_end, symbols] = Translator::load_elf(argv[1], SIZE_MAX);
+
+		// Translate up to the last non-zero word (the zeroed .bss tail holds no code)
+		//   word i of the image is at base + i*4
+		size_t words = image.size() / 4;
+		auto word_at = [&](const size_t i) { u32 w; std::memcpy(&w, &image[i*4], 4); return w; };
+		while (words && word_at(words-1) == 0)
+			--words;
+
+		std::vector<Translator::DecodedOp> ops(words);
+		for (size_t i = 0; i < words; ++i)
+			ops[i] = Translator::decode(word_at(i), base + i*4);
+
+		// Block leaders: the entry point, direct targets, return addresses, and
+		//   code addresses built by LUI/AUIPC (+ADDI) in case they are jumped to
+		std::set<u64> leaders{entry};
+		auto add_leader = [&](const u64 addr) { if (!(addr & 3) && addr >= base && (addr - base)/4 < words) leaders.insert(addr); };
+		for (size_t i = 0; i < words; ++i)
+		{
+			const auto& d = ops[i];
+			if (d.op == Op::JAL || (d.op >= Op::BEQ && d.op <= Op::BGEU))
+				add_leader(d.imm);
+			if (Translator::ends_block(d.op))
+				add_leader(base + (i+1)*4);
+			if (d.op == Op::LI)
+			{
+				add_leader(d.imm);
+				if (i+1 < words && ops[i+1].op == Op::ADDI && ops[i+1].rd == d.rd && ops[i+1].rs1 == d.rd)
+					add_leader(d.imm + ops[i+1].imm);
+			}
+		}
+
+		std::ofstream out(argv[2]);
+		if (!out)
+			throw std::invalid_argument(std::format("Failed to open output file: {}", argv[2]));
+
+		out << std::format(
+			"// Generated by rv64im_aot from {} - do not edit\n"
+			"\n"
+			"#pragma once\n"
+			"\n"
+			"#include \"TinyElfRISCV64.h\"\n"
+			"\n"
+			"class {} : public TinyRISCV64::ElfVM\n"
+			"{{\n"
+			"public:\n"
+			"\tusing ElfVM::ElfVM;\n"
+			"\n"
+			"\t// Load the ELF this class was translated from\n"
+			"\tTinyRISCV64::u64 program_load(const std::string& prog_filename) override\n"
+			"\t{{\n"
+			"\t\tconst auto entry = ElfVM::program_load(prog_filename);\n"
+			"\t\tif (program.size() < {} || !image_matches())\n"
+			"\t\t\tthrow std::invalid_argument(\"ELF does not match the translated program: \" + prog_filename);\n"
+			"\t\treturn entry;\n"
+			"\t}}\n"
+			"\n"
+			"\t// Execute the translated program (hides VM::execute_program)\n"
+			"\tvoid execute_program(const TinyRISCV64::u64 entry_point = 0x{:x}, const size_t max_instructions = 100000)\n"
+			"\t{{\n"
+			"\t\trun_translated(entry_point, max_instructions, [this](const TinyRISCV64::u64 addr, const size_t budget) {{ return run_block(addr, budget); }});\n"
+			"\t}}\n"
+			"\n"
+			"private:\n"
+			"\tusing i64 = TinyRISCV64::i64;\n"
+			"\n"
+			"\tbool image_matches() const\n"
+			"\t{{\n"
+			"\t\tTinyRISCV64::u64 h = 0xcbf29ce484222325ULL;\n"
+			"\t\tfor (size_t i = 0; i < {}; ++i)\n"
+			"\t\t\th = (h ^ program[i]) * 0x100000001b3ULL;\n"
+			"\t\treturn h == 0x{:x}ULL;\n"
+			"\t}}\n"
+			"\n"
+			"\t// Run the block at addr if it was translated and fits in budget; returns instructions run\n"
+			"\tsize_t run_block(const TinyRISCV64::u64 addr, const size_t budget)\n"
+			"\t{{\n"
+			"\t\tswitch(addr)\n"
+			"\t\t{{\n",
+			argv[1], class_name, words*4, entry, words*4, fnv1a(image.data(), words*4));
+
+		// One function per block (keeps compile times down), dispatched by address
+		std::vector<std::pair<size_t,size_t>> blocks; // {first, len}
+		for (auto it = leaders.begin(); it != leaders.end(); ++it)
+		{
+			const size_t first = (*it - base) / 4;
+			const size_t next = std::next(it) == leaders.end() ? words : (*std::next(it) - base) / 4;
+			size_t last = first;
+			while (last + 1 < next && !Translator::ends_block(ops[last].op))
+				++last;
+			blocks.emplace_back(first, last - first + 1);
+		}
+
+		for (const auto& [first, len] : blocks)
+			out << std::format("\t\t\tcase 0x{0:x}: if (budget < {1}) return 0; block_{0:x}(); return {1};\n", base + first*4, len);
+		out << "\t\t\tdefault: return 0;\n"
+		       "\t\t}\n"
+		       "\t}\n";
+
+		for (const auto& [first, len] : blocks)
+		{
+			// Named after the function it's in, where the ELF has symbols
+			const u64 addr = base + first*4;
+			const std::string where = symbols->at(addr) ? " // "+symbols->describe(addr) : "";
+			out << std::format("\n\tvoid block_{:x}(){}\n\t{{\n", addr, where);
+			for (size_t i = first; i < first + len; ++i)
+			{
+				const auto& d = ops[i];
+				out << std::format("\t\texec_op<Op::{0}>({{Op::{0}, {1}, {2}, {3}, 0x{4:08x}, {5}}});\n",
+					op_name(d.op), d.rd, d.rs1, d.rs2, d.inst, imm_literal(d.imm));
+			}
+			out << "\t}\n";
+		}
+		out << "};\n";
+
+		if (!out)
+			throw std::runtime_error(std::format("Failed to write output file: {}", argv[2]));
+		std::printf("Translated %zu instructions in %zu blocks\n", words, blocks.size());
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Neil Stephens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "../../TinyExecutorRISCV64.h"
+
+//Throughput of the executor running the same ELF job over and over, from one worker
+//up to one per core, e.g.
+//	scaling sha512sumO2 random.dat 64 JIT
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::string names;
+		for (const auto& [name, engine] : TinyRISCV64::engine_names)
+			names.append(names.empty() ? "" : "|").append(name);
+		std::fprintf(stderr, "Usage: %s <elf_file> <data_file> [jobs] [%s]\n", argv[0], names.c_str());
+		return 1;
+	}
+	const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	const size_t jobs = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 8*cores;
+	auto engine = TinyRISCV64::Engine::Block;
+	if (argc > 4)
+	{
+		const auto it = std::find_if(std::begin(TinyRISCV64::engine_names), std::end(TinyRISCV64::engine_names), [&](const auto& e) { return std::string(e.first) == argv[4]; });
+		if (it == std::end(TinyRISCV64::engine_names))
+		{
+			std::fprintf(stderr, "Unknown engine: %s\n", argv[4]);
+			return 1;
+		}
+		engine = it->second;
+	}
+
+	try
+	{
+		const auto image = TinyRISCV64::ElfVM::load_image(argv[1]);
+		std::ifstream data(argv[2], std::ios::binary);
+		if (!data)
+			throw std::invalid_argument("Failed to open data file: " + std::string(argv[2]));
+		std::vector<uint8_t> input((std::istreambuf_iterator<char>(data)), std::istreambuf_iterator<char>());
+
+		std::string expected;
+		double base = 0;
+		std::printf("%zu jobs, %zu cores\n", jobs, cores);
+		std::printf("threads  seconds   jobs/s  speedup\n");
+		for (size_t threads = 1;; threads = std::min(threads*2, cores))
+		{
+			TinyRISCV64::Executor executor(threads, engine);
+			std::vector<std::future<TinyRISCV64::Executor::Result>> results;
+			const auto start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < jobs; ++i)
+				results.push_back(executor.submit({image, input, {}, 100UL*1024*1024, true}));
+			for (auto& future : results)
+			{
+				const auto result = future.get();
+				if (result.status != TinyRISCV64::RunStatus::Halted)
+					throw std::runtime_error("Job didn't halt: " + result.trap);
+				if (expected.empty())
+					expected = result.output;
+				else if (result.output != expected)
+					throw std::runtime_error("Job output differs: '" + result.output + "' != '" + expected + "'");
+			}
+			const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			const double rate = jobs / elapsed.count();
+			if (threads == 1)
+				base = rate;
+			std::printf("%7zu %8.3f %8.1f %8.2f\n", threads, elapsed.count(), rate, rate / base);
+			if (threads == cores)
+				break;
+		}
+	}
+	catch (const std::exception &e)
+	{
+		std::fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
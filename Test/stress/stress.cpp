@@ -31,8 +31,12 @@
 #include <inttypes.h>
 #include <fstream>
 #include <sstream>
+#include <chrono>
+#include <iterator>
 
-#include "../../TinyElfRISCV64.h"
+#include "../../TinySchedulerRISCV64.h"
+#include "../../TinyExecutorRISCV64.h"
+#include "../../TinyLockstepRISCV64.h"
 
 extern "C"
 {
@@ -50,7 +54,13 @@ extern "C"
 }
 
 int run_raw(TinyRISCV64::VM& vm, const char* bin_file);
-int run_elf(TinyRISCV64::ElfVM& vm, const char* data_file, TinyRISCV64::u64 entry_point);
+int run_elf(TinyRISCV64::ElfVM& vm, const char* data_file, TinyRISCV64::u64 entry_point, size_t slice = 0);
+int run_scheduled(std::shared_ptr<const TinyRISCV64::VM::Image> image, TinyRISCV64::Engine engine, TinyRISCV64::Memory memory, const char* data_file);
+int run_async(std::shared_ptr<const TinyRISCV64::VM::Image> image, TinyRISCV64::Engine engine, TinyRISCV64::Memory memory, const char* data_file);
+int run_executor(std::shared_ptr<const TinyRISCV64::VM::Image> image, TinyRISCV64::Engine engine, TinyRISCV64::Memory memory, const char* data_file);
+int run_symbols(TinyRISCV64::ElfVM& vm);
+std::string native_sha512(const char* data_file);
+bool check_get_addrs(std::vector<uint8_t> native_buf, const std::vector<uint8_t>& buf, uint64_t res, uint64_t src, uint64_t dst);
 
 int main(int argc, char** argv)
 {
@@ -61,32 +71,114 @@ int main(int argc, char** argv)
 	}
 	const char* bin_file = argv[1];
 
-	// Create VM with a modest stack (4 KiB)
-	TinyRISCV64::ElfVM vm(4096);
-	bool bin_is_elf;
-	const char* data_file;
-	TinyRISCV64::u64 entry_point;
+	//Run the stress test on every execution engine and memory backing
+	//an ELF is also loaded once into an image shared by a second VM per configuration,
+	std::shared_ptr<const TinyRISCV64::VM::Image> image;
 	try
 	{
-		entry_point = vm.program_load(bin_file);
-		bin_is_elf = true;
-		if (argc < 3)
-		{
-			std::fprintf(stderr, "Error: no data file provided.\n");
-			return 1;
-		}
-		data_file = argv[2];
+		image = TinyRISCV64::ElfVM::load_image(bin_file);
 	}
-	catch(const std::exception &e)
+	catch(const std::exception&) {}
+
+	const char* snapshot_file = "stress.snapshot";
+	int ret = 0;
+	for (const auto& [memory_name, memory] : TinyRISCV64::memory_names)
+	for (const auto& [engine_name, engine] : TinyRISCV64::engine_names)
 	{
-		std::fprintf(stderr, "Loading as elf failed: '%s' , assuming raw bytecode.\n", e.what());
-		bin_is_elf = false;
-	}
+		// Create VM with a modest stack (4 KiB)
+		TinyRISCV64::ElfVM vm(4096, 1024UL*1024, engine);
+		vm.set_memory(memory);
+		bool bin_is_elf;
+		const char* data_file = nullptr;
+		TinyRISCV64::u64 entry_point;
+		try
+		{
+			entry_point = vm.program_load(bin_file);
+			bin_is_elf = true;
+			if (argc < 3)
+			{
+				std::fprintf(stderr, "Error: no data file provided.\n");
+				return 1;
+			}
+			data_file = argv[2];
+		}
+		catch(const std::exception &e)
+		{
+			std::fprintf(stderr, "Loading as elf failed: '%s' , assuming raw bytecode.\n", e.what());
+			bin_is_elf = false;
+		}
+
+		if (bin_is_elf)
+		{
+			//a VM restored from a snapshot of that one runs first, before it changes,
+			//in time slices that end mid-block
+			TinyRISCV64::ElfVM restored_vm(4096, 1024UL*1024, engine);
+			std::printf("%s engine, %s memory, restored:\n", engine_name, memory_name);
+			try
+			{
+				vm.snapshot_save(snapshot_file);
+				restored_vm.snapshot_load(snapshot_file);
+				ret |= run_elf(restored_vm,data_file,entry_point,10007);
+
+				//but not once its code is corrupted (the program section starts on the page after the header)
+				{
+					std::fstream fout(snapshot_file, std::ios::in | std::ios::out | std::ios::binary);
+					fout.seekp(4096 + (entry_point - vm.verified_code().base));
+					const uint32_t invalid = 0xffffffff;
+					fout.write(reinterpret_cast<const char*>(&invalid), sizeof invalid);
+				}
+				TinyRISCV64::ElfVM corrupt_vm(4096, 1024UL*1024, engine);
+				bool refused = false;
+				try
+				{
+					corrupt_vm.snapshot_load(snapshot_file);
+				}
+				catch(const std::invalid_argument& e)
+				{
+					refused = std::string(e.what()).starts_with("Invalid instruction");
+				}
+				std::cout<<"Verified equal : "<<refused<<std::endl;
+				ret |= !refused;
+			}
+			catch(const std::exception &e)
+			{
+				std::fprintf(stderr, "error: %s\n", e.what());
+				ret |= 1;
+			}
+		}
 
-	return bin_is_elf ? run_elf(vm,data_file,entry_point) : run_raw(vm,bin_file);
+		std::printf("%s engine, %s memory:\n", engine_name, memory_name);
+		const auto start = std::chrono::steady_clock::now();
+		ret |= bin_is_elf ? run_elf(vm,data_file,entry_point) : run_raw(vm,bin_file);
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::printf("%s engine, %s memory: %.3fs\n", engine_name, memory_name, elapsed.count());
+
+		if (bin_is_elf)
+		{
+			//and a fork of that VM runs first, leaving the original unchanged
+			TinyRISCV64::ElfVM shared_vm(4096, 1024UL*1024, engine);
+			shared_vm.set_memory(memory);
+			const auto shared_entry = shared_vm.program_attach(image);
+			const auto fork = shared_vm.fork();
+			std::printf("%s engine, %s memory, forked:\n", engine_name, memory_name);
+			ret |= run_elf(dynamic_cast<TinyRISCV64::ElfVM&>(*fork),data_file,shared_entry);
+			std::printf("%s engine, %s memory, shared image:\n", engine_name, memory_name);
+			ret |= run_elf(shared_vm,data_file,shared_entry);
+			std::printf("%s engine, %s memory, symbols:\n", engine_name, memory_name);
+			ret |= run_symbols(shared_vm);
+			std::printf("%s engine, %s memory, scheduled:\n", engine_name, memory_name);
+			ret |= run_scheduled(image,engine,memory,data_file);
+			std::printf("%s engine, %s memory, async:\n", engine_name, memory_name);
+			ret |= run_async(image,engine,memory,data_file);
+			std::printf("%s engine, %s memory, executor:\n", engine_name, memory_name);
+			ret |= run_executor(image,engine,memory,data_file);
+		}
+	}
+	std::remove(snapshot_file);
+	return ret;
 }
 
-int run_elf(TinyRISCV64::ElfVM& vm, const char* data_file, TinyRISCV64::u64 entry_point)
+int run_elf(TinyRISCV64::ElfVM& vm, const char* data_file, TinyRISCV64::u64 entry_point, size_t slice)
 {
 	const TinyRISCV64::u64 stdin_fd = 0, stdout_fd = 1, stderr_fd = 2;
 	try
@@ -105,32 +197,27 @@ int run_elf(TinyRISCV64::ElfVM& vm, const char* data_file, TinyRISCV64::u64 entr
 		auto pErrStream = std::make_shared<std::stringstream>();
 		vm.map_fd(stderr_fd,pErrStream);
 
-		vm.execute_program(entry_point,100UL*1024*1024); //100 million instructions max
+		if (slice)
+		{
+			//run() keeps the progress of each slice, and continues from it
+			vm.start_program(entry_point);
+			auto status = TinyRISCV64::RunStatus::FuelExhausted;
+			for (size_t ran = 0; status == TinyRISCV64::RunStatus::FuelExhausted; ran += slice)
+			{
+				if (ran > 100UL*1024*1024)
+					throw std::runtime_error("Maximum instruction count exceeded");
+				status = vm.run(slice);
+			}
+			if (status == TinyRISCV64::RunStatus::Trap)
+				throw std::runtime_error(vm.trap_reason());
+		}
+		else
+			vm.execute_program(entry_point,100UL*1024*1024); //100 million instructions max
 		std::string vm_output;
 		*pOutStream >> vm_output;
 
-		#if defined(WIN32) || defined(_WIN32) || defined(__WIN32)
 		pDataStream->close();
-		char sha_hex[129];
-		if(!get_sha512_lowercase(data_file, sha_hex, sizeof(sha_hex)))
-			throw std::runtime_error("Failed to compute SHA-512 hash of data file natively on host");
-		#else
-		//reset the file stream
-		pDataStream->clear();
-		pDataStream->seekg(0, std::ios::beg);
-
-		char buf[1024];
-		struct sha512 sha;
-		sha512_init(&sha);
-		do
-		{
-			pDataStream->read(buf, sizeof(buf));
-			sha512_append(&sha, buf, pDataStream->gcount());
-		}while(pDataStream->gcount() > 0);
-		char sha_hex[SHA512_HEX_SIZE];
-		sha512_finalize_hex(&sha, sha_hex);
-		#endif
-		const std::string native_output(sha_hex);
+		const std::string native_output = native_sha512(data_file);
 
 		if(vm_output != native_output)
 		{
@@ -148,67 +235,555 @@ int run_elf(TinyRISCV64::ElfVM& vm, const char* data_file, TinyRISCV64::u64 entr
 	return 0;
 }
 
+int run_scheduled(std::shared_ptr<const TinyRISCV64::VM::Image> image, TinyRISCV64::Engine engine, TinyRISCV64::Memory memory, const char* data_file)
+{
+	try
+	{
+		//a few VMs share one thread, reading stdin from pipes fed a chunk at a time:
+		//each parks when its pipe runs dry, until the next chunk (or the end) arrives
+		std::ifstream data(data_file, std::ios::binary);
+		if (!data)
+			throw std::invalid_argument("Failed to open data file: " + std::string(data_file));
+		TinyRISCV64::Scheduler scheduler(10007);
+		std::vector<std::shared_ptr<TinyRISCV64::Pipe>> inputs;
+		std::vector<std::shared_ptr<std::stringstream>> outputs, errors;
+		std::vector<TinyRISCV64::Scheduler::Id> ids;
+		for (int priority = 0; priority < 3; ++priority)
+		{
+			auto vm = std::make_unique<TinyRISCV64::ElfVM>(4096, 1024UL*1024, engine);
+			vm->set_memory(memory);
+			const auto entry = vm->program_attach(image);
+			inputs.push_back(std::make_shared<TinyRISCV64::Pipe>());
+			outputs.push_back(std::make_shared<std::stringstream>());
+			errors.push_back(std::make_shared<std::stringstream>());
+			vm->map_fd(0,inputs.back());
+			vm->map_fd(1,outputs.back());
+			vm->map_fd(2,errors.back());
+			ids.push_back(scheduler.add(std::move(vm),entry,priority));
+		}
+
+		char chunk[3000]; //not a multiple of the guest's reads
+		while (scheduler.run() > 0)
+		{
+			data.read(chunk, sizeof(chunk));
+			for (auto& input : inputs)
+				data.gcount() > 0 ? input->feed(chunk, data.gcount()) : input->close();
+		}
+
+		const std::string native_output = native_sha512(data_file);
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			if (scheduler.state(ids[i]) != TinyRISCV64::Scheduler::State::Halted)
+				throw std::runtime_error("Scheduled VM didn't halt: " + scheduler.vm(ids[i]).trap_reason());
+			std::string vm_output;
+			*outputs[i] >> vm_output;
+			if(vm_output != native_output)
+				throw std::runtime_error("Scheduled program output: '"+vm_output+"' != '"+native_output
+					+"'\n"+"Program StdErr: '"+errors[i]->str()+"'");
+		}
+	}
+	catch (const std::exception &e)
+	{
+		std::fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+	std::printf("PASS\n");
+	return 0;
+}
+
+int run_async(std::shared_ptr<const TinyRISCV64::VM::Image> image, TinyRISCV64::Engine engine, TinyRISCV64::Memory memory, const char* data_file)
+{
+	try
+	{
+		//the guest runs as a coroutine, suspending whenever its stdin pipe runs dry
+		//and resuming inside each feed() of the next chunk
+		std::ifstream data(data_file, std::ios::binary);
+		if (!data)
+			throw std::invalid_argument("Failed to open data file: " + std::string(data_file));
+		//a dry pipe has nothing yet, rather than end of file, until it's closed and drained
+		{
+			TinyRISCV64::Pipe pipe;
+			char byte;
+			const bool dry = !pipe.try_take(&byte, 1);
+			pipe.feed("x", 1);
+			pipe.close();
+			const auto last = pipe.try_take(&byte, 1);
+			const auto end = pipe.try_take(&byte, 1);
+			if (!dry || last != 1u || end != 0u)
+				throw std::runtime_error("Pipe reported end of file while open, or not once closed");
+		}
+
+		TinyRISCV64::ElfVM vm(4096, 1024UL*1024, engine);
+		vm.set_memory(memory);
+		const auto entry = vm.program_attach(image);
+		auto input = std::make_shared<TinyRISCV64::Pipe>();
+		auto output = std::make_shared<std::stringstream>();
+		auto errors = std::make_shared<std::stringstream>();
+		vm.map_fd(0,input);
+		vm.map_fd(1,output);
+		vm.map_fd(2,errors);
+
+		std::exception_ptr error;
+		auto async = vm.execute_async(entry,100UL*1024*1024);
+		async.start([&error](std::exception_ptr e) { error = e; });
+		char chunk[3000];
+		while (!async.done())
+		{
+			data.read(chunk, sizeof(chunk));
+			data.gcount() > 0 ? input->feed(chunk, data.gcount()) : input->close();
+		}
+		if (error)
+			std::rethrow_exception(error);
+
+		std::string vm_output;
+		*output >> vm_output;
+		const std::string native_output = native_sha512(data_file);
+		if(vm_output != native_output)
+			throw std::runtime_error("Async program output: '"+vm_output+"' != '"+native_output
+				+"'\n"+"Program StdErr: '"+errors->str()+"'");
+	}
+	catch (const std::exception &e)
+	{
+		std::fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+	std::printf("PASS\n");
+	return 0;
+}
+
+int run_executor(std::shared_ptr<const TinyRISCV64::VM::Image> image, TinyRISCV64::Engine engine, TinyRISCV64::Memory memory, const char* data_file)
+{
+	try
+	{
+		//a few jobs over the same input on a pool of two workers, each reusing its VM for the next job:
+		//one runs out of fuel, and the worker's next job still starts afresh
+		std::ifstream data(data_file, std::ios::binary);
+		if (!data)
+			throw std::invalid_argument("Failed to open data file: " + std::string(data_file));
+		std::vector<uint8_t> input((std::istreambuf_iterator<char>(data)), std::istreambuf_iterator<char>());
+		TinyRISCV64::Executor executor(2, engine, memory);
+		std::vector<std::future<TinyRISCV64::Executor::Result>> results;
+		for (size_t fuel : {100UL*1024*1024, 100UL*1024*1024, 1000UL, 100UL*1024*1024})
+			results.push_back(executor.submit({image, input, {}, fuel, true}));
+
+		const std::string native_output = native_sha512(data_file);
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			auto result = results[i].get();
+			if (i == 2)
+			{
+				if (result.status != TinyRISCV64::RunStatus::FuelExhausted || result.retired != 1000)
+					throw std::runtime_error("Executor job didn't run out of fuel: " + result.trap);
+				continue;
+			}
+			if (result.status != TinyRISCV64::RunStatus::Halted)
+				throw std::runtime_error("Executor job didn't halt: " + result.trap);
+			std::istringstream output(result.output);
+			std::string vm_output;
+			output >> vm_output;
+			if(vm_output != native_output)
+				throw std::runtime_error("Executor program output: '"+vm_output+"' != '"+native_output
+					+"'\n"+"Program StdErr: '"+result.errors+"'");
+		}
+
+		//a callback that throws leaves its worker running, and wait() rethrows it
+		executor.submit({image, input, {}, 1000, true}, [](TinyRISCV64::Executor::Result) { throw std::logic_error("callback"); });
+		bool rethrown = false;
+		try
+		{
+			executor.wait();
+		}
+		catch (const std::logic_error& e)
+		{
+			rethrown = std::string(e.what()) == "callback";
+		}
+		executor.wait();
+		if (!rethrown || executor.submit({image, input, {}, 1000, true}).get().retired != 1000)
+			throw std::runtime_error("Executor callback exception wasn't rethrown by wait()");
+	}
+	catch (const std::exception &e)
+	{
+		std::fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+	std::printf("PASS\n");
+	return 0;
+}
+
+int run_symbols(TinyRISCV64::ElfVM& vm)
+{
+	try
+	{
+		//functions are found by name, and addresses within them by symbol
+		const auto& symbols = vm.symbols();
+		const auto hex = symbols.address("sha512_hex");
+		const auto* symbol = symbols.at(hex + 4);
+		if (!symbol || symbols.name(*symbol) != "sha512_hex" || symbols.describe(hex + 4) != "sha512_hex+0x4")
+			throw std::runtime_error("Symbol at 0x"+std::to_string(hex + 4)+" is "+symbols.describe(hex + 4));
+		if (symbols.find("no_such_symbol"))
+			throw std::runtime_error("Found a symbol that isn't there");
+
+		//and its code was verified from each of them when it was loaded
+		const auto& code = vm.verified_code();
+		if (!code.reached_at(hex) || code.indirect.empty())
+			throw std::runtime_error("Code from sha512_hex wasn't verified");
+
+		//and called by name, after the program has run
+		std::vector<uint8_t> data(300);
+		uint64_t x = 0xfedcba9876543210ULL;
+		for (auto& byte : data)
+		{
+			x = x * 6364136223846793005ULL + 1ULL;
+			byte = static_cast<uint8_t>(x >> 56);
+		}
+		char guest_hex[SHA512_HEX_SIZE] = {};
+		char native_hex[SHA512_HEX_SIZE];
+		vm.call<void>({"sha512_hex", 10000000}, std::span<const uint8_t>(data), data.size(), std::span<char>(guest_hex));
+		sha512_hex(data.data(), data.size(), native_hex);
+		const bool equal = std::string(guest_hex) == native_hex;
+		std::cout<<"Symbols equal : "<<equal<<std::endl;
+		if (!equal)
+			return 1;
+	}
+	catch (const std::exception &e)
+	{
+		std::fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
+
+std::string native_sha512(const char* data_file)
+{
+	#if defined(WIN32) || defined(_WIN32) || defined(__WIN32)
+	char sha_hex[129];
+	if(!get_sha512_lowercase(data_file, sha_hex, sizeof(sha_hex)))
+		throw std::runtime_error("Failed to compute SHA-512 hash of data file natively on host");
+	#else
+	std::ifstream data(data_file, std::ios::binary);
+	if (!data)
+		throw std::invalid_argument("Failed to open data file: " + std::string(data_file));
+
+	char buf[1024];
+	struct sha512 sha;
+	sha512_init(&sha);
+	do
+	{
+		data.read(buf, sizeof(buf));
+		sha512_append(&sha, buf, data.gcount());
+	}while(data.gcount() > 0);
+	char sha_hex[SHA512_HEX_SIZE];
+	sha512_finalize_hex(&sha, sha_hex);
+	#endif
+	return sha_hex;
+}
+
+//run get_addrs natively over native_buf (a copy of the input) and compare with what the VM left
+bool check_get_addrs(std::vector<uint8_t> native_buf, const std::vector<uint8_t>& buf, uint64_t res, uint64_t src, uint64_t dst)
+{
+	uint64_t native_src=0, native_dst=0;
+	const uint64_t native_res = get_addrs(native_buf.data(),native_buf.size(),&native_src,&native_dst);
+	return native_buf==buf && native_res==res && native_src==src && native_dst==dst;
+}
+
 int run_raw(TinyRISCV64::VM& vm, const char* bin_file)
 {
 	try
 	{
-		//create a buffer to process
+		//create buffers to process: the first is mapped, then the second (smaller)
+		//is rebound in its place, keeping the VM state, then the third is mapped
+		//as a second data region behind a read-only one
 		constexpr size_t buf_size = 1024;
-		std::vector<uint8_t> buf(buf_size);
+		std::vector<uint8_t> bufs[] = {std::vector<uint8_t>(buf_size), std::vector<uint8_t>(buf_size/2), std::vector<uint8_t>(buf_size*3/4)};
+		std::vector<uint8_t> read_only(100, 0x5a);
 
-		// Initialize buffer with deterministic 64-bit LCG-derived bytes
+		// Initialize buffers with deterministic 64-bit LCG-derived bytes
 		uint64_t x = 0x0123456789abcdefULL;
-		for (size_t i = 0; i < buf_size; ++i)
+		for (auto& buf : bufs)
 		{
-			x = x * 6364136223846793005ULL + 1ULL;
-			buf[i] = static_cast<uint8_t>(x >> 56);
+			for (size_t i = 0; i < buf.size(); ++i)
+			{
+				x = x * 6364136223846793005ULL + 1ULL;
+				buf[i] = static_cast<uint8_t>(x >> 56);
+			}
 		}
 
-		//copy the buffer for comparison later
-		std::vector<uint8_t> native_buf(buf);
-
 		vm.VM::program_load(bin_file);
-		auto data_addr_buf = vm.map_data_mem(buf.data(),buf.size());
-
-		//the program implements get_addrs(u8*,sz,u64*,u64*)
-
-		// make room on the stack for the results
-		auto stack_addr_src = vm.stack_push<uint64_t>(0);
-		auto stack_addr_dst = vm.stack_push<uint64_t>(0);
-
-		//set the fn arg registers
-		vm.register_set(10,data_addr_buf);
-		vm.register_set(11,buf.size());
-		vm.register_set(12,stack_addr_src);
-		vm.register_set(13,stack_addr_dst);
-
-		vm.execute_program();
-
-		//Get the results
-		auto res = vm.register_get(10);
-		auto dst = vm.stack_pop<uint64_t>();
-		auto src = vm.stack_pop<uint64_t>();
-		std::printf("res = 0x%016" PRIx64 "\n", res);
-		std::printf("src = 0x%016" PRIx64 "\n", src);
-		std::printf("dst = 0x%016" PRIx64 "\n", dst);
-
-		uint64_t native_src=0, native_dst=0;
-		uint64_t native_res = get_addrs(native_buf.data(),native_buf.size(),&native_src,&native_dst);
-		std::printf("native_res = 0x%016" PRIx64 "\n", native_res);
-		std::printf("native_src = 0x%016" PRIx64 "\n", native_src);
-		std::printf("native_dst = 0x%016" PRIx64 "\n", native_dst);
-
-		std::cout<<"Buffer equal : "<<(native_buf==buf)<<std::endl;
-		std::cout<<"Result equal : "<<(native_res==res)<<std::endl;
-		std::cout<<"Source equal : "<<(native_src==src)<<std::endl;
-		std::cout<<"Destin equal : "<<(native_dst==dst)<<std::endl;
-
-		if(native_buf!=buf
-		   || native_res!=res
-		   || native_src!=src
-		   || native_dst!=dst)
-			return 1;
+		TinyRISCV64::u64 data_addr_buf = 0;
 
+		for (auto& buf : bufs)
+		{
+			//copy the buffer for comparison later
+			std::vector<uint8_t> native_buf(buf);
+
+			if (&buf == &bufs[0])
+				data_addr_buf = vm.map_data_mem(buf.data(),buf.size());
+			else if (&buf == &bufs[1])
+			{
+				if (vm.rebind_data_mem(buf.data(),buf.size()) != data_addr_buf)
+					throw std::runtime_error("Rebound data memory moved");
+			}
+			else
+			{
+				const TinyRISCV64::DataBuffer regions[] = {{read_only, true}, {buf}};
+				const auto addrs = vm.map_data_mem(regions);
+				data_addr_buf = addrs[1];
+				if (addrs[0] + read_only.size() + 64 > data_addr_buf)
+					throw std::runtime_error("Data regions overlap");
+			}
+
+			//the program implements get_addrs(u8*,sz,u64*,u64*)
+
+			// make room on the stack for the results
+			auto stack_addr_src = vm.stack_push<uint64_t>(0);
+			auto stack_addr_dst = vm.stack_push<uint64_t>(0);
+
+			//set the fn arg registers
+			vm.register_set(10,data_addr_buf);
+			vm.register_set(11,buf.size());
+			vm.register_set(12,stack_addr_src);
+			vm.register_set(13,stack_addr_dst);
+
+			vm.execute_program();
+
+			//Get the results
+			auto res = vm.register_get(10);
+			auto dst = vm.stack_pop<uint64_t>();
+			auto src = vm.stack_pop<uint64_t>();
+			std::printf("res = 0x%016" PRIx64 "\n", res);
+			std::printf("src = 0x%016" PRIx64 "\n", src);
+			std::printf("dst = 0x%016" PRIx64 "\n", dst);
+
+			uint64_t native_src=0, native_dst=0;
+			uint64_t native_res = get_addrs(native_buf.data(),native_buf.size(),&native_src,&native_dst);
+			std::printf("native_res = 0x%016" PRIx64 "\n", native_res);
+			std::printf("native_src = 0x%016" PRIx64 "\n", native_src);
+			std::printf("native_dst = 0x%016" PRIx64 "\n", native_dst);
+
+			std::cout<<"Buffer equal : "<<(native_buf==buf)<<std::endl;
+			std::cout<<"Result equal : "<<(native_res==res)<<std::endl;
+			std::cout<<"Source equal : "<<(native_src==src)<<std::endl;
+			std::cout<<"Destin equal : "<<(native_dst==dst)<<std::endl;
+
+			if(native_buf!=buf
+			   || native_res!=res
+			   || native_src!=src
+			   || native_dst!=dst)
+				return 1;
+		}
+
+		//a raw image attached as it is runs its own copy, free to write its globals, unless it is shared read-only
+		{
+			const char* image_file = "stress.image";
+			const uint32_t words[] = {0x00003423, 0x00c0006f, 0xdeadbeef, 0xdeadbeef}; // sd zero,8(zero); j end; .dword
+			std::ofstream(image_file, std::ios::binary).write(reinterpret_cast<const char*>(words), sizeof words);
+			TinyRISCV64::VM own(4096, 1024, vm.get_engine()), shared(4096, 1024, vm.get_engine());
+			own.set_memory(vm.get_memory());
+			shared.set_memory(vm.get_memory());
+			own.program_attach(TinyRISCV64::VM::load_image(image_file));
+			shared.program_attach(TinyRISCV64::VM::load_image(image_file, 1024, sizeof words));
+			std::remove(image_file);
+			own.execute_program();
+			bool refused = false;
+			try
+			{
+				shared.execute_program();
+			}
+			catch (const std::runtime_error&)
+			{
+				refused = true;
+			}
+			const bool equal = own.peek<uint64_t>(8) == 0 && refused && shared.peek<uint64_t>(8) != 0;
+			std::cout<<"Image equal : "<<equal<<std::endl;
+			if (!equal)
+				return 1;
+		}
+
+		//a store to the read-only region and a load from the gap after it fault with every memory backing
+		{
+			TinyRISCV64::VM probe(4096, 1024, vm.get_engine());
+			probe.set_memory(vm.get_memory());
+			const uint32_t store[] = {0x00053023}, load[] = {0x00053503}; // sd zero,0(a0) / ld a0,0(a0)
+			const TinyRISCV64::DataBuffer regions[] = {{read_only, true}, {bufs[2]}};
+			for (const auto* code : {store, load})
+			{
+				probe.program_load(reinterpret_cast<const uint8_t*>(code), 4);
+				const auto addrs = probe.map_data_mem(regions);
+				probe.register_set(10, code == store ? addrs[0] : addrs[0] + read_only.size());
+				bool faulted = false;
+				try
+				{
+					probe.execute_program();
+				}
+				catch (const std::runtime_error&)
+				{
+					faulted = true;
+				}
+				std::cout<<"Fault equal : "<<faulted<<std::endl;
+				if (!faulted || read_only != std::vector<uint8_t>(100, 0x5a))
+					return 1;
+			}
+		}
+
+		//and a load past the data traps with the instructions up to it retired, the guarded fault included
+		{
+			TinyRISCV64::VM probe(4096, 1024, vm.get_engine());
+			probe.set_memory(vm.get_memory());
+			const uint32_t code[] = {0x00100593, 0x00158593, 0x00053503}; // li a1,1; addi a1,a1,1; ld a0,0(a0)
+			probe.program_load(reinterpret_cast<const uint8_t*>(code), sizeof(code));
+			probe.register_set(10, probe.map_data_mem(bufs[2].data(), bufs[2].size()) + bufs[2].size());
+			probe.start_program();
+			const bool trapped = probe.run(100) == TinyRISCV64::RunStatus::Trap
+				&& probe.trap_reason() == "Memory access out of bounds"
+				&& probe.retired_count() == 3 && probe.register_get(11) == 2;
+			std::cout<<"Trap equal : "<<trapped<<std::endl;
+			if (!trapped)
+				return 1;
+		}
+
+		//then each buffer again (largest last), in one batch call
+		std::vector<std::vector<uint8_t>> batch = {bufs[1], bufs[2], bufs[0]};
+		const std::vector<std::vector<uint8_t>> native_batch(batch);
+		const std::vector<std::span<uint8_t>> inputs(batch.begin(), batch.end());
+		using TinyRISCV64::BatchArg;
+		const BatchArg args[] = {BatchArg::Data, BatchArg::Size, BatchArg::Out, BatchArg::Out};
+		const auto results = vm.execute_batch(inputs, args);
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			const bool equal = check_get_addrs(native_batch[i], batch[i], results[i].value, results[i].outs[0], results[i].outs[1]);
+			std::cout<<"Batch equal : "<<equal<<std::endl;
+			if (!equal)
+				return 1;
+		}
+
+		//and as a typed call, which copies the buffer and result slots in and back out
+		{
+			auto buf = bufs[0];
+			uint64_t src=0, dst=0;
+			const auto sp = vm.register_get(2);
+			const int res = vm.call<int>(0, std::span<uint8_t>(buf), buf.size(), std::span<uint64_t>(&src,1), std::span<uint64_t>(&dst,1));
+			const bool equal = check_get_addrs(bufs[0], buf, res, src, dst) && vm.register_get(2)==sp;
+			std::cout<<"Call equal : "<<equal<<std::endl;
+			if (!equal)
+				return 1;
+		}
+
+		//and a bigger batch of varied sizes side by side, more than one group of lanes
+		std::vector<std::vector<uint8_t>> lanes;
+		for (size_t i = 0; i < TinyRISCV64::LockstepVM::lanes + 3; ++i)
+		{
+			lanes.emplace_back(64 + i*96);
+			for (auto& byte : lanes.back())
+			{
+				x = x * 6364136223846793005ULL + 1ULL;
+				byte = static_cast<uint8_t>(x >> 56);
+			}
+		}
+		const std::vector<std::vector<uint8_t>> native_lanes(lanes);
+		TinyRISCV64::LockstepVM lockstep;
+		lockstep.program_load(bin_file);
+		const std::vector<std::span<uint8_t>> lane_inputs(lanes.begin(), lanes.end());
+		const auto lane_results = lockstep.execute_lockstep(lane_inputs, args);
+		for (size_t i = 0; i < lanes.size(); ++i)
+		{
+			const bool equal = check_get_addrs(native_lanes[i], lanes[i], lane_results[i].value, lane_results[i].outs[0], lane_results[i].outs[1]);
+			std::cout<<"Lockstep equal : "<<equal<<std::endl;
+			if (!equal)
+				return 1;
+		}
+
+		//and loaded at a non-zero base, as if linked there: nothing below it is backed
+		{
+			std::ifstream fin(bin_file, std::ios::binary);
+			const std::vector<uint8_t> code{std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>()};
+			constexpr TinyRISCV64::u64 base = 0x10000;
+			if (vm.program_load(code.data(), code.size(), base) != base || lockstep.program_load(code.data(), code.size(), base) != base)
+				throw std::runtime_error("Program not loaded at its base");
+
+			//bad code is refused by the load, leaving the loaded program in place:
+			//an invalid instruction, and a jump past the end
+			const uint32_t bad_code[][2] = {{0x00000013, 0xffffffff}, {0x0100006f, 0x00000013}};
+
+			for (const auto& words : bad_code)
+			{
+				bool refused = false;
+				try
+				{
+					vm.program_load(reinterpret_cast<const uint8_t*>(words), sizeof(words), base);
+				}
+				catch (const std::invalid_argument&)
+				{
+					refused = true;
+				}
+				if (!refused || !vm.verified_code().reached_at(base))
+					throw std::runtime_error("Bad code was loaded");
+			}
+
+			//and so is code with an invalid word in a function of its symbol table, even one nothing calls
+			{
+				const uint32_t words[] = {0x00500513, 0x0080006f, 0xffffffff}; // li a0,5; j end; dead: .word -1
+				const auto image = [&](const bool named)
+				{
+					const std::vector<TinyRISCV64::Symbols::Symbol> symbols = {{base + 8, 4, 0, TinyRISCV64::Symbols::Kind::Function, true}};
+					const auto bytes = reinterpret_cast<const uint8_t*>(words);
+					return std::make_shared<const TinyRISCV64::VM::Image>(TinyRISCV64::Bytes(bytes, bytes + sizeof words), base,
+						base + sizeof words, base, 0, std::make_shared<const TinyRISCV64::Symbols>(named ? symbols
+						: std::vector<TinyRISCV64::Symbols::Symbol>(), std::string("dead", 5)));
+				};
+				image(false);
+				bool refused = false;
+				try
+				{
+					image(true);
+				}
+				catch (const std::invalid_argument& e)
+				{
+					refused = std::string(e.what()) == "Invalid instruction 0xffffffff at dead";
+				}
+				if (!refused)
+					throw std::runtime_error("Bad function was loaded");
+			}
+
+			//while code that halts by falling off its end, jumping there or an EBREAK (even in its first
+			//word, with nothing mapped before it) is good, and so is a call that never returns, whatever follows it
+			const std::pair<std::vector<uint32_t>, uint64_t> good_code[] = {
+				{{0x00500513}, 5},                                                     // li a0,5
+				{{0x00500513, 0x0040006f}, 5},                                         // li a0,5; j end
+				{{0x00100073, 0x00900513}, 0},                                         // ebreak; li a0,9
+				{{0x00600513, 0x00100073, 0x00900513}, 6},                             // li a0,6; ebreak; li a0,9
+				{{0x00008293, 0x008000ef, 0xffffffff, 0x00700513, 0x00028067}, 7}      // mv t0,ra; call f; .word -1; f: li a0,7; jr t0
+			};
+			TinyRISCV64::VM good(4096, 1024, vm.get_engine());
+			for (const auto& [words, result] : good_code)
+			{
+				good.program_load(reinterpret_cast<const uint8_t*>(words.data()), words.size() * 4, base);
+				good.execute_program();
+				if (good.register_get(10) != result)
+					throw std::runtime_error("Good code didn't run");
+			}
+			bool below = false;
+			try
+			{
+				vm.peek<uint64_t>(base - 8);
+			}
+			catch (const std::runtime_error&)
+			{
+				below = true;
+			}
+			const std::vector<std::vector<uint8_t>> native_based = {native_lanes[1], native_lanes.back()};
+			std::vector<std::vector<uint8_t>> based(native_based), based_lockstep(native_based);
+			const auto based_results = vm.execute_batch(std::vector<std::span<uint8_t>>(based.begin(), based.end()), args);
+			const auto based_lanes = lockstep.execute_lockstep(std::vector<std::span<uint8_t>>(based_lockstep.begin(), based_lockstep.end()), args);
+			for (size_t i = 0; i < based.size(); ++i)
+			{
+				const bool equal = below
+					&& check_get_addrs(native_based[i], based[i], based_results[i].value, based_results[i].outs[0], based_results[i].outs[1])
+					&& check_get_addrs(native_based[i], based_lockstep[i], based_lanes[i].value, based_lanes[i].outs[0], based_lanes[i].outs[1]);
+				std::cout<<"Based equal : "<<equal<<std::endl;
+				if (!equal)
+					return 1;
+			}
+		}
 	}
 	catch (const std::exception &e)
 	{
@@ -42,10 +42,207 @@
 #include <random>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
+#include <functional>
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <string_view>
+#include <tuple>
+#include <optional>
 
 namespace TinyRISCV64
 {
 
+// A byte stream the host feeds while a guest reads it (see ElfVM::map_fd()), from any thread
+//   a guest read returns what is there; with nothing there, VM::run() parks the guest (see
+//   ElfVM::blocked_on()) to retry the read when there is, and execute_program() gets -EAGAIN
+//   once closed and drained, reads return 0 (end of file)
+class Pipe : public std::iostream
+{
+public:
+	Pipe() : std::iostream(&buf) {}
+
+	// Append bytes for the reader
+	void feed(const void* const data, const size_t size)
+	{
+		std::vector<std::function<void()>> wake;
+		{
+			std::lock_guard lock(mutex);
+			if (head > bytes.size() / 2) // drop what was read
+			{
+				bytes.erase(0, head);
+				head = 0;
+			}
+			bytes.append(static_cast<const char*>(data), size);
+			if (size)
+				wake.swap(waiters);
+		}
+		for (auto& f : wake)
+			f();
+	}
+
+	// No more input: readers see end of file once they have drained it
+	void close()
+	{
+		std::vector<std::function<void()>> wake;
+		{
+			std::lock_guard lock(mutex);
+			closed = true;
+			wake.swap(waiters);
+		}
+		for (auto& f : wake)
+			f();
+	}
+
+	// Take up to size bytes; returns how many, 0 if there are none yet or it's closed (see readable())
+	size_t take(void* const dst, const size_t size)
+	{
+		return try_take(dst, size).value_or(0);
+	}
+
+	// take(), telling the two apart under one lock: returns nothing if there are none yet,
+	//   and 0 only once it's closed and drained (or size is 0)
+	std::optional<size_t> try_take(void* const dst, const size_t size)
+	{
+		std::lock_guard lock(mutex);
+		const size_t n = std::min(size, bytes.size() - head);
+		if (!n && size && !closed)
+			return std::nullopt;
+		std::memcpy(dst, bytes.data() + head, n);
+		head += n;
+		return n;
+	}
+
+	// A read won't have to wait: there's input, or there won't be any more
+	bool readable() const
+	{
+		std::lock_guard lock(mutex);
+		return closed || head < bytes.size();
+	}
+
+	// Call f once the pipe becomes readable, from the thread that feeds or closes it
+	//   returns false, without calling f, if it's readable already
+	bool when_readable(std::function<void()> f)
+	{
+		std::lock_guard lock(mutex);
+		if (closed || head < bytes.size())
+			return false;
+		waiters.push_back(std::move(f));
+		return true;
+	}
+
+private:
+	// The iostream side: writes feed the pipe, reads take from it
+	class Buffer : public std::streambuf
+	{
+	public:
+		explicit Buffer(Pipe& pipe) : pipe(pipe) {}
+	protected:
+		int_type underflow() override
+		{
+			const size_t n = pipe.take(get.data(), get.size());
+			if (!n)
+				return traits_type::eof();
+			setg(get.data(), get.data(), get.data() + n);
+			return traits_type::to_int_type(get[0]);
+		}
+		int_type overflow(const int_type c) override
+		{
+			if (!traits_type::eq_int_type(c, traits_type::eof()))
+			{
+				const char ch = traits_type::to_char_type(c);
+				pipe.feed(&ch, 1);
+			}
+			return traits_type::not_eof(c);
+		}
+		std::streamsize xsputn(const char* const data, const std::streamsize size) override
+		{
+			pipe.feed(data, size);
+			return size;
+		}
+	private:
+		Pipe& pipe;
+		std::array<char, 256> get;
+	};
+
+	mutable std::mutex mutex;
+	std::string bytes;   // Input, read up to head
+	size_t head = 0;
+	bool closed = false;
+	std::vector<std::function<void()>> waiters; // See when_readable()
+	Buffer buf{*this};
+};
+
+// A guest run as a coroutine (see ElfVM::execute_async()), suspended while the guest waits for Pipe
+//   input and resumed by the thread that feeds the pipe, so an event loop needs no thread per guest
+//   it starts when awaited, or with start(); it must outlive the run
+class AsyncRun
+{
+public:
+	struct promise_type
+	{
+		std::coroutine_handle<> awaiting;
+		std::function<void(std::exception_ptr)> on_done;
+		std::exception_ptr error;
+
+		AsyncRun get_return_object() { return AsyncRun(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		auto final_suspend() noexcept
+		{
+			struct Done
+			{
+				bool await_ready() noexcept { return false; }
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> run) noexcept
+				{
+					auto& promise = run.promise();
+					const std::coroutine_handle<> next = promise.awaiting ? promise.awaiting : std::noop_coroutine();
+					if (promise.on_done) // may destroy the run
+						promise.on_done(promise.error);
+					return next;
+				}
+				void await_resume() noexcept {}
+			};
+			return Done{};
+		}
+		void return_void() {}
+		void unhandled_exception() { error = std::current_exception(); }
+	};
+
+	AsyncRun(AsyncRun&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+	AsyncRun(const AsyncRun&) = delete;
+	AsyncRun& operator=(const AsyncRun&) = delete;
+	AsyncRun& operator=(AsyncRun&&) = delete;
+	~AsyncRun() { if (handle) handle.destroy(); }
+
+	// Start running on this thread; on_done gets nullptr once the program halts, or what it failed
+	//   with, on the thread that finished it (on_done may destroy this)
+	void start(std::function<void(std::exception_ptr)> on_done)
+	{
+		handle.promise().on_done = std::move(on_done);
+		handle.resume();
+	}
+
+	bool done() const { return handle.done(); }
+
+	// co_await runs it, resuming the awaiter once the program halts (or throwing what it failed with)
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(const std::coroutine_handle<> awaiter) noexcept
+	{
+		handle.promise().awaiting = awaiter;
+		return handle;
+	}
+	void await_resume() const
+	{
+		if (handle.promise().error)
+			std::rethrow_exception(handle.promise().error);
+	}
+
+private:
+	explicit AsyncRun(const std::coroutine_handle<promise_type> handle) : handle(handle) {}
+	std::coroutine_handle<promise_type> handle;
+};
+
 class ElfVM: public VM
 {
 private:
@@ -56,25 +253,65 @@ private:
 	// Kept as a member so reset() can restore tp without re-loading the ELF.
 	u64 tls_tp = 0;
 
+	// The program's functions and objects (see symbols())
+	std::shared_ptr<const Symbols> symbol_table = std::make_shared<const Symbols>();
+
+	// The empty pipe a read is waiting on (see blocked_on())
+	std::shared_ptr<Pipe> blocked;
+
 public:
-	ElfVM(const size_t stack_size = 4096, const size_t max_program_size = 1024UL*1024)
-		: VM(stack_size,max_program_size) {}
+	ElfVM(const size_t stack_size = 4096, const size_t max_program_size = 1024UL*1024, const Engine engine = Engine::Interpreter)
+		: VM(stack_size,max_program_size,engine) {}
 
 	// Load program from elf file and return the entry_point addr
+	//   the code is verified from the entry point and the functions in the symbol table first (see VM::verified_code()),
+	//   so a bad one is refused even if nothing calls it
 	//   resets state and invalidates previous virtual addrs
 	u64 program_load(const std::string& prog_filename) override
 	{
-		auto [prog, entry, tp] = load_elf(prog_filename, max_prog_size);
+		auto [prog, base, entry, tp, ro_end, syms] = load_elf(prog_filename, max_prog_size);
+		verified = verify_code(prog, base, (base + prog.size() + 3) & ~3ull, entry, *syms);
 		tls_tp = tp;
+		symbol_table = std::move(syms);
 		program = std::move(prog);
+		image.reset();
+		p_beg = shared_end = base;
+		program_changed();
 		reset();
 		return entry;
 	}
 
-	// Reset all CPU state; re-apply tp so TLS works after every reset.
-	void reset() override
+	// Load an ELF into an image that VMs can share (see VM::program_attach())
+	//   the part below the first writable section is shared, unless code lies above it
+	static std::shared_ptr<const Image> load_image(const std::string& prog_filename, const size_t max_program_size = 1024UL*1024)
+	{
+		auto [prog, base, entry, tp, ro_end, syms] = load_elf(prog_filename, max_program_size);
+		return std::make_shared<const Image>(std::move(prog), base, ro_end, entry, tp, std::move(syms));
+	}
+
+	// Attach a shared program image and return its entry point (see VM::program_attach())
+	u64 program_attach(std::shared_ptr<const Image> shared) override
 	{
-		VM::reset();
+		tls_tp = shared->tls_tp;
+		symbol_table = shared->symbols;
+		return VM::program_attach(std::move(shared));
+	}
+
+	// A copy of this VM sharing its fd streams (see VM::fork())
+	std::unique_ptr<VM> fork() override
+	{
+		auto child = std::make_unique<ElfVM>(stack_bytes(), max_prog_size, engine);
+		child->fd_streams = fd_streams;
+		child->tls_tp = tls_tp;
+		child->symbol_table = symbol_table;
+		fork_into(*child);
+		return child;
+	}
+
+	// Reset the registers; re-apply tp so TLS works after every reset.
+	void reset_registers() override
+	{
+		VM::reset_registers();
 		// Point the thread pointer (tp/x4) at the TLS block so that local-exec
 		// %tprel accesses (e.g. errno) resolve correctly:
 		//   tp + (symbol_vaddr - pt_tls.p_vaddr)  →  symbol_vaddr  ✓
@@ -84,12 +321,86 @@ public:
 			x[4] = tls_tp;
 	}
 
+	// The program's symbol table, empty if its ELF has none (or it wasn't loaded from an ELF)
+	const Symbols& symbols() const { return *symbol_table; }
+
+	// A guest function by name, and the instruction budget to call it with (see CallTarget)
+	struct NamedCall
+	{
+		NamedCall(const std::string_view name, const size_t max_instructions = 100000) : name(name), max_instructions(max_instructions) {}
+		std::string_view name;
+		size_t max_instructions;
+	};
+
+	// Call the named guest function (see VM::call()); a host calling it often should keep its address
+	using VM::call;
+	template<typename R = u64, typename... Args>
+	R call(const NamedCall target, const Args&... args)
+	{
+		return call<R>(CallTarget(symbol_table->address(target.name), target.max_instructions), args...);
+	}
+
 	// Map a host iostream to a guest file descriptor number.
 	void map_fd(const u64 fd, std::shared_ptr<std::iostream> stream)
 	{
 		fd_streams[fd] = std::move(stream);
 	}
 
+	// Run the program as a coroutine: like execute_program(), but a read from an empty Pipe suspends
+	//   it until the pipe is fed or closed (instead of getting -EAGAIN), and guest faults are thrown
+	//   as std::runtime_error; the VM mustn't be used otherwise until it's done
+	AsyncRun execute_async(const u64 entry_point, size_t max_instructions = 100000)
+	{
+		// Wakes the run from the thread that makes the pipe readable (blocked keeps the pipe)
+		struct Readable
+		{
+			Pipe* pipe;
+			bool await_ready() const { return pipe->readable(); }
+			bool await_suspend(const std::coroutine_handle<> run) { return pipe->when_readable([run] { run.resume(); }); }
+			void await_resume() const {}
+		};
+
+		start_program(entry_point);
+		for (;;)
+		{
+			const RunStatus status = run(max_instructions);
+			max_instructions -= retired_count();
+			if (status == RunStatus::Halted)
+				co_return;
+			if (status == RunStatus::Trap)
+				throw std::runtime_error(trap_reason());
+			if (status == RunStatus::FuelExhausted)
+				throw std::runtime_error("Maximum instruction count exceeded");
+			if (blocked)
+				co_await Readable{blocked.get()};
+		}
+	}
+
+	// The pipe the guest is waiting to read after VM::run() returned RunStatus::Yield, or nullptr
+	//   if it yielded for another reason; running it again before the pipe is readable just yields again
+	const std::shared_ptr<Pipe>& blocked_on() const { return blocked; }
+
+protected:
+
+	// tls_tp and the fds open when saved; restoring needs a stream mapped for each of them (see map_fd())
+	std::vector<u64> snapshot_extra() const override
+	{
+		std::vector<u64> extra{tls_tp};
+		for (const auto& [fd, stream] : fd_streams)
+			extra.push_back(fd);
+		return extra;
+	}
+
+	void snapshot_restore_extra(std::span<const u64> extra) override
+	{
+		if (extra.empty())
+			throw std::invalid_argument("Snapshot is of another kind of VM");
+		for (const u64 fd : extra.subspan(1))
+			if (!fd_streams.contains(fd))
+				throw std::invalid_argument(std::format("Snapshot fd {} is not mapped", fd));
+		tls_tp = extra[0];
+	}
+
 private:
 
 	// Read a null-terminated string from guest memory
@@ -345,11 +656,28 @@ private:
 			}
 			case 63: // read(fd, buf, count)
 			{
+				blocked.reset();
 				auto it = fd_streams.find(a0);
 				if (it == fd_streams.end()) { x[10] = static_cast<u64>(-9LL); return; } // -EBADF
 				std::vector<char> buf(a2);
-				it->second->read(buf.data(), static_cast<std::streamsize>(a2));
-				const u64 n = static_cast<u64>(it->second->gcount());
+				u64 n;
+				if (auto pipe = std::dynamic_pointer_cast<Pipe>(it->second))
+				{
+					const auto taken = pipe->try_take(buf.data(), a2);
+					if (!taken) // wait for input, rerunning the ECALL
+					{
+						if (!yield_program()) { x[10] = static_cast<u64>(-11LL); return; } // -EAGAIN
+						blocked = std::move(pipe);
+						pc -= 4;
+						return;
+					}
+					n = *taken;
+				}
+				else
+				{
+					it->second->read(buf.data(), static_cast<std::streamsize>(a2));
+					n = static_cast<u64>(it->second->gcount());
+				}
 				for (u64 i = 0; i < n; ++i)
 					mem_store<u8>(a1 + i, static_cast<u8>(buf[i]));
 				x[10] = n;
@@ -415,6 +743,12 @@ private:
 				x[10] = 0; // NOP — return success
 				return;
 
+			case 124:        // sched_yield
+				blocked.reset();
+				yield_program(); // ends a VM::run() with RunStatus::Yield
+				x[10] = 0;
+				return;
+
 			case 220:                              // clone
 			case 221:                              // execve
 				x[10] = static_cast<u64>(-38LL); // -ENOSYS — multi-process not supported
@@ -428,20 +762,22 @@ private:
 		}
 	}
 
-	static std::tuple<std::vector<u8>, u64, u64> load_elf(const std::string& filename, const size_t max_size)
-	{
-		// ----- read entire file ------------------------------------------------
-		std::ifstream fin(filename, std::ios::binary | std::ios::ate);
-		if (!fin)
-			throw std::invalid_argument(std::format("Failed to open ELF file: {}", filename));
+protected:
 
-		const size_t file_size = static_cast<size_t>(fin.tellg());
+	// Load the PT_LOAD segments of an ELF into a program image
+	//   returns the image, the address it starts at (the lowest segment's page), entry point, TLS base,
+	//   the end of its read-only part (see VM::Image) and its symbols
+	//   the file is mapped, not read: segment pages are mapped into the image copy-on-write where they
+	//   line up, and only read as they are touched, and .bss and the heap take no memory until written
+	static std::tuple<Bytes, u64, u64, u64, u64, std::shared_ptr<const Symbols>> load_elf(const std::string& filename, const size_t max_size)
+	{
+		// ----- map the file -----------------------------------------------------
+		const MappedFile file(filename);
+		const size_t file_size = file.size();
 		if (file_size < sizeof(Elf64Ehdr))
 			throw std::invalid_argument(std::format("File too small to be a valid ELF64 binary: {}", filename));
 
-		fin.seekg(0, std::ios::beg);
-		std::vector<u8> file_data(file_size);
-		fin.read(reinterpret_cast<char*>(file_data.data()), file_size);
+		const std::span<const u8> file_data(file.data(), file_size);
 
 		// ----- parse and validate ELF header -----------------------------------
 		Elf64Ehdr ehdr;
@@ -584,12 +920,15 @@ private:
 			throw std::invalid_argument(
 				"ELF has no loadable (PT_LOAD) segments — nothing to execute");
 
+		// Only the span from the lowest segment's page is backed, wherever the ELF was linked
+		const u64 base = vaddr_min & ~PageTable::page_mask;
+
 		// Size check
-		if (vaddr_max > max_size)
+		if (vaddr_max - base > max_size)
 			throw std::invalid_argument(
 				std::format("ELF virtual address span [0x{:x}, 0x{:x}) requires {} bytes which exceeds max_program_size={}; "
 					"construct the VM with a larger max_program_size",
-					vaddr_min, vaddr_max, vaddr_max, max_size));
+					vaddr_min, vaddr_max, vaddr_max - base, max_size));
 
 		if (ehdr.e_entry < vaddr_min || ehdr.e_entry >= vaddr_max)
 			throw std::invalid_argument(
@@ -597,10 +936,57 @@ private:
 					"the binary may not have been linked correctly",
 					ehdr.e_entry, vaddr_min, vaddr_max));
 
+		// ----- read-only part: below the first writable section (or segment) ----
+		// The part shared by an Image ends on a page; nothing is shared if code lies above it
+		u64 write_min = vaddr_max;
+		u64 exec_end  = 0;
+		const bool sections = ehdr.e_shoff != 0 && ehdr.e_shentsize >= sizeof(Elf64Shdr)
+			&& ehdr.e_shoff + static_cast<u64>(ehdr.e_shnum) * ehdr.e_shentsize <= file_size;
+		for (u16 i = 0; i < (sections ? ehdr.e_shnum : ehdr.e_phnum); ++i)
+		{
+			u64 addr, size;
+			bool alloc, write, exec;
+			if (sections)
+			{
+				Elf64Shdr shdr;
+				std::memcpy(&shdr,
+					file_data.data() + ehdr.e_shoff + i * ehdr.e_shentsize,
+					sizeof(Elf64Shdr));
+				addr  = shdr.sh_addr;
+				size  = shdr.sh_size;
+				alloc = shdr.sh_flags & 0x2 /*SHF_ALLOC*/;
+				write = shdr.sh_flags & 0x1 /*SHF_WRITE*/;
+				exec  = shdr.sh_flags & 0x4 /*SHF_EXECINSTR*/;
+			}
+			else
+			{
+				Elf64Phdr phdr;
+				std::memcpy(&phdr,
+					file_data.data() + ehdr.e_phoff + i * ehdr.e_phentsize,
+					sizeof(Elf64Phdr));
+				addr  = phdr.p_vaddr;
+				size  = phdr.p_memsz;
+				alloc = phdr.p_type == 1 /*PT_LOAD*/;
+				write = phdr.p_flags & 0x2 /*PF_W*/;
+				exec  = phdr.p_flags & 0x1 /*PF_X*/;
+			}
+			if (!alloc || size == 0)
+				continue;
+			if (write)
+				write_min = std::min(write_min, addr);
+			if (exec)
+				exec_end = std::max(exec_end, addr + size);
+		}
+		u64 ro_end = write_min < vaddr_max ? write_min & ~PageTable::page_mask : vaddr_max;
+		if (exec_end > ro_end || ro_end < base)
+			ro_end = base;
+
 		// ----- second pass: populate program image ----------------------------
-		// Allocate zeroed image covering [0, vaddr_max).
-		// Zero-initialisation takes care of the .bss region (p_memsz > p_filesz).
-		std::vector<u8> prog(vaddr_max, 0);
+		// Allocate zeroed image covering [base, vaddr_max).
+		// Zero-initialisation takes care of the .bss region (p_memsz > p_filesz),
+		// and leaves its pages untouched (see ZeroPageAllocator).
+		Bytes prog(vaddr_max - base);
+		const bool mappable = ZeroPageAllocator<u8>::mapped(prog.size());
 
 		for (u16 i = 0; i < ehdr.e_phnum; ++i)
 		{
@@ -612,12 +998,16 @@ private:
 			if (phdr.p_type != 1 /*PT_LOAD*/ || phdr.p_filesz == 0)
 				continue;
 
-			std::memcpy(prog.data() + phdr.p_vaddr,
-				file_data.data() + phdr.p_offset,
-				phdr.p_filesz);
+			if (mappable)
+				file.map_to(prog.data() + (phdr.p_vaddr - base), phdr.p_offset, phdr.p_filesz);
+			else
+				std::memcpy(prog.data() + (phdr.p_vaddr - base),
+					file_data.data() + phdr.p_offset,
+					phdr.p_filesz);
 		}
 
-		return {std::move(prog), ehdr.e_entry, tls_tp};
+		return {std::move(prog), base, ehdr.e_entry, tls_tp, ro_end,
+			sections ? load_symbols(file_data, ehdr) : std::make_shared<const Symbols>()};
 	}
 
 	struct Elf64Ehdr
@@ -651,6 +1041,87 @@ private:
 		u64 p_align;  // Alignment (must be power of two)
 	};
 	static_assert(sizeof(Elf64Phdr) == 56, "Elf64Phdr must be 56 bytes");
+
+	struct Elf64Shdr
+	{
+		u32 sh_name;      // Name (index into the section name string table)
+		u32 sh_type;      // Section type
+		u64 sh_flags;     // Section flags (SHF_WRITE=1, SHF_ALLOC=2, SHF_EXECINSTR=4)
+		u64 sh_addr;      // Virtual address in memory
+		u64 sh_offset;    // Offset in file
+		u64 sh_size;      // Size in bytes
+		u32 sh_link;      // Linked section index
+		u32 sh_info;      // Extra information
+		u64 sh_addralign; // Alignment
+		u64 sh_entsize;   // Entry size, for tables
+	};
+	static_assert(sizeof(Elf64Shdr) == 64, "Elf64Shdr must be 64 bytes");
+
+	struct Elf64Sym
+	{
+		u32 st_name;  // Name (index into the linked string table)
+		u8 st_info;   // Type (low 4 bits: STT_NOTYPE=0, STT_OBJECT=1, STT_FUNC=2) and binding (STB_LOCAL=0)
+		u8 st_other;  // Visibility
+		u16 st_shndx; // Section it's defined in (SHN_UNDEF=0)
+		u64 st_value; // Address
+		u64 st_size;  // Size in bytes
+	};
+	static_assert(sizeof(Elf64Sym) == 24, "Elf64Sym must be 24 bytes");
+
+	// The functions, objects and global labels in an ELF's .symtab (none if it's stripped or malformed)
+	static std::shared_ptr<const Symbols> load_symbols(const std::span<const u8> file_data, const Elf64Ehdr& ehdr)
+	{
+		const auto section = [&](const u64 i)
+		{
+			Elf64Shdr shdr;
+			std::memcpy(&shdr,
+				file_data.data() + ehdr.e_shoff + i * ehdr.e_shentsize,
+				sizeof(Elf64Shdr));
+			return shdr;
+		};
+		std::vector<Symbols::Symbol> symbols;
+		std::string names;
+		for (u16 i = 0; i < ehdr.e_shnum; ++i)
+		{
+			const Elf64Shdr symtab = section(i);
+			if (symtab.sh_type != 2 /*SHT_SYMTAB*/ || symtab.sh_link >= ehdr.e_shnum
+				|| symtab.sh_entsize < sizeof(Elf64Sym) || symtab.sh_offset + symtab.sh_size > file_data.size())
+				continue;
+			const Elf64Shdr strtab = section(symtab.sh_link);
+			if (strtab.sh_offset + strtab.sh_size > file_data.size())
+				continue;
+			const char* const strings = reinterpret_cast<const char*>(file_data.data() + strtab.sh_offset);
+
+			for (u64 j = 1; j < symtab.sh_size / symtab.sh_entsize; ++j)
+			{
+				Elf64Sym sym;
+				std::memcpy(&sym,
+					file_data.data() + symtab.sh_offset + j * symtab.sh_entsize,
+					sizeof(Elf64Sym));
+				const u8 type = sym.st_info & 0xf;
+				const bool global = sym.st_info >> 4 != 0 /*STB_LOCAL*/;
+				if (sym.st_shndx == 0 /*SHN_UNDEF*/ || sym.st_shndx >= 0xff00 /*SHN_ABS, SHN_COMMON...*/
+					|| sym.st_name >= strtab.sh_size)
+					continue;
+				Symbols::Kind kind;
+				if (type == 2 /*STT_FUNC*/)
+					kind = Symbols::Kind::Function;
+				else if (type == 1 /*STT_OBJECT*/)
+					kind = Symbols::Kind::Object;
+				else if (type == 0 /*STT_NOTYPE*/ && global) // not the local $x mapping symbols
+					kind = Symbols::Kind::Other;
+				else
+					continue;
+				const size_t length = strnlen(strings + sym.st_name, strtab.sh_size - sym.st_name);
+				if (!length || length == strtab.sh_size - sym.st_name)
+					continue;
+				symbols.push_back({sym.st_value, sym.st_size, static_cast<u32>(names.size()), kind, global});
+				names.append(strings + sym.st_name, length);
+				names.push_back('\0');
+			}
+		}
+		return std::make_shared<const Symbols>(std::move(symbols), std::move(names));
+	}
 };
 
 } // namespace TinyRISCV64
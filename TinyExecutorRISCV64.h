@@ -0,0 +1,344 @@
+/*
+ * TinyRISCV64 extension to run batches of guest jobs across threads
+ *
+ * https://github.com/neilstephens/TinyRISCV64
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Neil Stephens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TINYEXECUTORRISCV64_H
+#define TINYEXECUTORRISCV64_H
+
+#include "TinyElfRISCV64.h"
+
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+#include <memory>
+#include <deque>
+#include <optional>
+#include <span>
+#include <string>
+#include <sstream>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+namespace TinyRISCV64
+{
+
+// Runs independent guest jobs on a pool of threads, each with its own ElfVM that is reused from job to job
+//   jobs are queued on the workers in turn (or on the submitting worker's own queue), and a worker
+//   that runs out takes the oldest jobs from the others' queues
+class Executor
+{
+public:
+	// One guest run: the input is mapped as the data region, its address and size passed in a0 and a1,
+	//   and is also the guest's stdin; it must stay valid until the job is done, and be read-only
+	//   for jobs running at once to share it
+	struct Job
+	{
+		std::shared_ptr<const VM::Image> program;
+		std::span<u8> input;
+		std::optional<u64> entry;   // The program's entry point if not given
+		size_t fuel = 100000;       // Instruction budget (see VM::run())
+		bool read_only = false;     // Stores to the input fault (see VM::map_data_mem())
+	};
+
+	struct Result
+	{
+		RunStatus status;           // Halted, FuelExhausted or Trap
+		u64 value;                  // a0 when it stopped: the return value or exit status
+		size_t retired;             // Instructions retired
+		std::string trap;           // Why it trapped (see VM::trap_reason())
+		std::string output;         // What it wrote to stdout
+		std::string errors;         // and stderr
+	};
+
+	using Callback = std::function<void(Result)>;
+
+	// threads defaults to the hardware's; the workers' VMs are all made alike
+	explicit Executor(size_t threads = 0, const Engine engine = Engine::Interpreter, const Memory memory = Memory::Regions,
+		const size_t stack_size = 4096, const size_t max_program_size = 1024UL*1024)
+	{
+		if (!threads)
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		for (size_t i = 0; i < threads; ++i)
+		{
+			auto worker = std::make_unique<Worker>();
+			worker->vm = std::make_unique<ElfVM>(stack_size, max_program_size, engine);
+			worker->vm->set_memory(memory);
+			workers.push_back(std::move(worker));
+		}
+		for (size_t i = 0; i < threads; ++i)
+			workers[i]->thread = std::thread([this, i] { work(i); });
+	}
+	Executor(const Executor&) = delete;
+	Executor& operator=(const Executor&) = delete;
+
+	// Finishes the jobs already submitted
+	~Executor()
+	{
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+		work_cv.notify_all();
+		for (auto& worker : workers)
+			worker->thread.join();
+	}
+
+	// Queue a job, calling done with its result on the worker thread that ran it
+	//   an exception from done is kept for wait() to rethrow, and doesn't stop the worker
+	void submit(Job job, Callback done)
+	{
+		if (!job.program)
+			throw std::invalid_argument("Executor job needs a program image");
+		{
+			std::lock_guard lock(mutex);
+			const size_t i = current_owner == this ? current_index : next++ % workers.size();
+			{
+				std::lock_guard queue_lock(workers[i]->mutex);
+				workers[i]->tasks.push_back(Task{std::move(job), std::move(done)});
+			}
+			++queued;
+			++pending;
+		}
+		work_cv.notify_one();
+	}
+
+	// Queue a job, for its result later
+	std::future<Result> submit(Job job)
+	{
+		auto promise = std::make_shared<std::promise<Result>>();
+		auto result = promise->get_future();
+		submit(std::move(job), [promise](Result r) { promise->set_value(std::move(r)); });
+		return result;
+	}
+
+	// Wait until every job submitted so far is done
+	//   then rethrows the first exception a callback threw since the last wait(), if any
+	void wait()
+	{
+		std::unique_lock lock(mutex);
+		done_cv.wait(lock, [this] { return !pending; });
+		if (callback_error)
+			std::rethrow_exception(std::exchange(callback_error, nullptr));
+	}
+
+	size_t size() const { return workers.size(); }
+
+private:
+	struct Task
+	{
+		Job job;
+		Callback done;
+	};
+
+	// A read-only stream over a job's input, for the guest's stdin
+	class Input : public std::iostream
+	{
+	public:
+		Input() : std::iostream(&buf) {}
+		void view(const std::span<u8> input)
+		{
+			buf.view(input);
+			clear();
+		}
+	private:
+		class Buffer : public std::streambuf
+		{
+		public:
+			void view(const std::span<u8> input)
+			{
+				char* const beg = reinterpret_cast<char*>(input.data());
+				setg(beg, beg, beg + input.size());
+			}
+		protected:
+			// Only the read position moves (lseek() seeks both)
+			pos_type seekoff(const off_type off, const std::ios_base::seekdir dir, const std::ios_base::openmode which) override
+			{
+				const off_type end = egptr() - eback();
+				off_type pos = dir == std::ios_base::beg ? 0 : dir == std::ios_base::cur ? gptr() - eback() : end;
+				if (!(which & std::ios_base::in))
+					return pos_type(gptr() - eback());
+				pos += off;
+				if (pos < 0 || pos > end)
+					return pos_type(off_type(-1));
+				setg(eback(), eback() + pos, egptr());
+				return pos_type(pos);
+			}
+			pos_type seekpos(const pos_type pos, const std::ios_base::openmode which) override
+			{
+				return seekoff(off_type(pos), std::ios_base::beg, which);
+			}
+		};
+		Buffer buf;
+	};
+
+	struct Worker
+	{
+		std::mutex mutex; // Guards tasks
+		std::deque<Task> tasks;
+		std::unique_ptr<ElfVM> vm;
+		std::shared_ptr<Input> input = std::make_shared<Input>();
+		std::shared_ptr<std::stringstream> output = std::make_shared<std::stringstream>();
+		std::shared_ptr<std::stringstream> errors = std::make_shared<std::stringstream>();
+		std::thread thread;
+	};
+
+	void work(const size_t index)
+	{
+		current_owner = this;
+		current_index = index;
+		for (;;)
+		{
+			std::optional<Task> task = take(index);
+			if (!task)
+			{
+				std::unique_lock lock(mutex);
+				work_cv.wait(lock, [this] { return queued || stopping; });
+				if (!queued)
+					return;
+				continue;
+			}
+			auto result = execute(*workers[index], task->job);
+			std::exception_ptr error;
+			if (task->done)
+			{
+				try
+				{
+					task->done(std::move(result));
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+				}
+			}
+			std::lock_guard lock(mutex);
+			if (error && !callback_error)
+				callback_error = error;
+			if (!--pending)
+				done_cv.notify_all();
+		}
+	}
+
+	// The newest job on this worker's queue, or else the oldest on another's
+	std::optional<Task> take(const size_t index)
+	{
+		std::optional<Task> task;
+		for (size_t n = 0; n < workers.size() && !task; ++n)
+		{
+			auto& worker = *workers[(index + n) % workers.size()];
+			std::lock_guard lock(worker.mutex);
+			if (worker.tasks.empty())
+				continue;
+			if (!n)
+			{
+				task.emplace(std::move(worker.tasks.back()));
+				worker.tasks.pop_back();
+			}
+			else
+			{
+				task.emplace(std::move(worker.tasks.front()));
+				worker.tasks.pop_front();
+			}
+		}
+		if (task)
+		{
+			std::lock_guard lock(mutex);
+			--queued;
+		}
+		return task;
+	}
+
+	static Result execute(Worker& worker, const Job& job)
+	{
+		auto& vm = *worker.vm;
+		Result result{RunStatus::Trap, 0, 0, {}, {}, {}};
+		try
+		{
+			const u64 entry = vm.program_attach(job.program);
+			const DataBuffer buffer{job.input, job.read_only};
+			const u64 data = vm.map_data_mem({&buffer, 1}).front();
+			worker.input->view(job.input);
+			worker.output->str(std::string());
+			worker.errors->str(std::string());
+			vm.map_fd(0, worker.input);
+			vm.map_fd(1, worker.output);
+			vm.map_fd(2, worker.errors);
+			vm.start_program(job.entry.value_or(entry));
+			vm.register_set(10, data);
+			vm.register_set(11, job.input.size());
+
+			// Guest yields (sched_yield) just continue, on what's left of the budget
+			size_t fuel = job.fuel;
+			for (;;)
+			{
+				result.status = vm.run(fuel);
+				result.retired += vm.retired_count();
+				if (result.status != RunStatus::Yield)
+					break;
+				fuel -= std::min(fuel, vm.retired_count());
+				if (!fuel)
+				{
+					result.status = RunStatus::FuelExhausted;
+					break;
+				}
+			}
+			result.value = vm.register_get(10);
+			if (result.status == RunStatus::Trap)
+				result.trap = vm.trap_reason();
+		}
+		catch (const std::exception& e)
+		{
+			result.status = RunStatus::Trap;
+			result.trap = e.what();
+		}
+		result.output = worker.output->str();
+		result.errors = worker.errors->str();
+		return result;
+	}
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::mutex mutex; // Guards the counts below and queues a job with its count
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+	size_t queued = 0;   // Jobs waiting in the queues
+	size_t pending = 0;  // Jobs submitted and not done yet
+	size_t next = 0;     // The queue the next job from outside goes on
+	bool stopping = false;
+	std::exception_ptr callback_error; // The first a callback threw since the last wait()
+
+	static inline thread_local Executor* current_owner = nullptr; // The executor whose worker this thread is
+	static inline thread_local size_t current_index = 0;
+};
+
+} // namespace TinyRISCV64
+
+#endif // TINYEXECUTORRISCV64_H
@@ -0,0 +1,600 @@
+/*
+ * TinyRISCV64 extension to run one guest function over many inputs in lockstep
+ *
+ * https://github.com/neilstephens/TinyRISCV64
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Neil Stephens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TINYLOCKSTEPRISCV64_H
+#define TINYLOCKSTEPRISCV64_H
+
+#include "TinyRISCV64.h"
+
+#include <cstdint>
+#include <vector>
+#include <span>
+#include <array>
+#include <stdexcept>
+#include <format>
+#include <cstring>
+#include <type_traits>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace TinyRISCV64
+{
+
+// Runs a guest function over a batch of inputs like VM::execute_batch(), but several inputs at once:
+//   each of them is a lane, with its own registers, data and stack, and every decoded op runs for all
+//   the lanes at its pc together, over registers laid out lane by lane (xs[reg][lane]); built for AVX2,
+//   the ALU ops and branches run on AVX2 vectors of four lanes (see exec_vector()), otherwise lane by lane
+//   lanes that branch apart wait while those at the lowest pc run on, so they meet again where their
+//   paths join; ops without a lane-wide form run lane by lane on the scalar VM
+class LockstepVM : public VM
+{
+public:
+	static constexpr size_t lanes = 8; // Inputs run at once: a register fills two AVX2 vectors
+
+	LockstepVM(const size_t stack_size = 4096, const size_t max_program_size = 1024UL*1024)
+		: VM(stack_size, max_program_size, Engine::Predecode) {}
+
+	// Call the function at entry_point once for each input buffer, lanes at a time, passing its arguments
+	//   as args describes, and return what each call returned (see VM::execute_batch())
+	//   max_instructions applies to each call; lanes can't write program memory or make system calls
+	//   resets state and invalidates previous virtual addrs
+	std::vector<BatchResult> execute_lockstep(std::span<const std::span<u8>> inputs, std::span<const BatchArg> args,
+		const u64 entry_point = base_entry, const size_t max_instructions = 100000)
+	{
+		if (args.size() > 8)
+			throw std::invalid_argument(std::format("Too many batch arguments ({}, max 8)", args.size()));
+		if (decoded.empty())
+			throw std::logic_error("Lockstep execution runs decoded ops: select an engine other than Engine::Interpreter");
+		std::vector<BatchResult> results;
+		if (inputs.empty())
+			return results;
+		results.reserve(inputs.size());
+		// Lay out data memory for the largest input; each lane maps its own input there
+		const auto largest = std::max_element(inputs.begin(), inputs.end(),
+			[](const auto& a, const auto& b) { return a.size() < b.size(); });
+		map_data_mem(largest->data(), largest->size());
+		sync_buffers();
+
+		for (size_t first = 0; first < inputs.size(); first += lanes)
+			run_lanes(inputs.subspan(first, std::min(lanes, inputs.size() - first)), args, entry_point, max_instructions, results);
+		return results;
+	}
+
+private:
+	using Lanes = std::array<u64, lanes>;
+
+	alignas(64) std::array<Lanes, 32> xs{}; // Registers of each lane
+	alignas(64) Lanes pcs{};                // Each lane's pc
+	alignas(64) Lanes mask{};               // All ones for the lanes running the current op
+	std::array<std::span<u8>, lanes> lane_data; // Each lane's input
+	std::vector<u8> lane_stacks;            // The lanes' stacks, interleaved a u64 at a time (see stack_row())
+
+	static constexpr u64 done = ~0ull; // pc of a finished (or unused) lane
+
+	// Ends with a jump or branch, which set the lanes' pcs (other ops leave them be)
+	static constexpr bool is_jump(const Op op)
+	{
+		const auto parts = fused_parts(op);
+		const Op last = parts.part[parts.width - 1];
+		return last >= Op::JAL && last <= Op::BGEU;
+	}
+
+	void run_lanes(const std::span<const std::span<u8>> inputs, const std::span<const BatchArg> args,
+		const u64 entry_point, const size_t max_instructions, std::vector<BatchResult>& results)
+	{
+		// fused_parts() and is_jump() by op, looked up once per op below
+		static constexpr FusedParts op_parts[] = {
+			#define TINYRISCV64_OP_PARTS(name) fused_parts(Op::name),
+			TINYRISCV64_OPS(TINYRISCV64_OP_PARTS)
+			#undef TINYRISCV64_OP_PARTS
+		};
+		static constexpr bool ends_in_jump[] = {
+			#define TINYRISCV64_OP_JUMP(name) is_jump(Op::name),
+			TINYRISCV64_OPS(TINYRISCV64_OP_JUMP)
+			#undef TINYRISCV64_OP_JUMP
+		};
+
+		const size_t outs = std::count(args.begin(), args.end(), BatchArg::Out);
+		lane_stacks.resize((s_end - s_beg + 7) / 8 * lanes * 8);
+
+		// Every lane starts as the scalar VM would, with zeroed result slots on its stack
+		reset_registers();
+		const u64 slots = x[2] - ((outs * 8 + 15) & ~15ull);
+		std::array<size_t, lanes> counts{};
+		for (size_t l = 0; l < lanes; ++l)
+		{
+			for (size_t r = 0; r < 32; ++r)
+				xs[r][l] = x[r];
+			pcs[l] = done;
+			if (l >= inputs.size())
+				continue;
+			lane_data[l] = inputs[l];
+			xs[2][l] = slots;
+			for (u64 a = slots; a < slots + outs*8; ++a)
+				*stack_byte(l, a) = 0;
+			for (size_t i = 0, out = 0; i < args.size(); ++i)
+			{
+				switch (args[i])
+				{
+					case BatchArg::Data: xs[10+i][l] = d_beg; break;
+					case BatchArg::Size: xs[10+i][l] = inputs[l].size(); break;
+					case BatchArg::Out:  xs[10+i][l] = slots + 8*out++; break;
+				}
+			}
+			pcs[l] = entry_point == base_entry ? p_beg : entry_point;
+		}
+
+		const RunLimits limits = run_limits(max_instructions);
+		for (;;)
+		{
+			// Gather the lanes at the lowest pc (finished lanes are at done, above them all),
+			//   and find where the next lowest waits, for them to catch up to
+			for (size_t l = 0; l < lanes; ++l)
+				pcs[l] = pcs[l] == limits.sentinel_pc ? done : pcs[l];
+			u64 at = done;
+			for (size_t l = 0; l < lanes; ++l)
+				at = std::min(at, pcs[l]);
+			if (at == done)
+				break;
+			u64 waiting = done;
+			size_t budget = limits.max;
+			for (size_t l = 0; l < lanes; ++l)
+			{
+				mask[l] = pcs[l] == at ? ~0ull : 0;
+				waiting = std::min(waiting, pcs[l] | mask[l]);
+				budget = std::min(budget, limits.max - (counts[l] & mask[l]));
+			}
+
+			// Run them together up to a jump or branch, or until they reach the waiting lanes
+			size_t ran = 0;
+			for (;;)
+			{
+				if (limits.outside(at)) [[unlikely]]
+					throw std::runtime_error("PC jumped program region");
+				if (at & 3) [[unlikely]]
+					throw std::runtime_error(std::format("Lockstep lanes can't run misaligned code (pc=0x{:x})", at));
+				const DecodedOp& d = decoded[op_index(at)];
+				const FusedParts& parts = op_parts[static_cast<u8>(d.op)];
+				const size_t width = parts.width;
+				if ((ran += width) > budget) [[unlikely]]
+					throw std::runtime_error("Maximum instruction count exceeded");
+				for (size_t i = 0; i < width; ++i)
+					exec_lanes(parts.part[i], (&d)[i], at + 4*i);
+				if (ends_in_jump[static_cast<u8>(d.op)]) // the lanes' pcs are set
+					break;
+				at += 4 * width;
+				if (at >= waiting || at == limits.sentinel_pc)
+				{
+					for (size_t l = 0; l < lanes; ++l)
+						pcs[l] = (at & mask[l]) | (pcs[l] & ~mask[l]);
+					break;
+				}
+			}
+			for (size_t l = 0; l < lanes; ++l)
+				counts[l] += ran & mask[l];
+		}
+
+		for (size_t l = 0; l < inputs.size(); ++l)
+		{
+			BatchResult result{xs[10][l], {}};
+			for (size_t i = 0; i < outs; ++i)
+				for (size_t b = 0; b < 8; ++b)
+					reinterpret_cast<u8*>(&result.outs[i])[b] = *stack_byte(l, slots + i*8 + b);
+			results.push_back(result);
+		}
+	}
+
+	// Run one op (not fused) at pc for the lanes in mask
+	void exec_lanes(const Op op, const DecodedOp& d, const u64 pc)
+	{
+		#if defined(__AVX2__)
+		if (exec_vector(op, d, pc))
+		{
+			xs[0] = {};
+			return;
+		}
+		#endif
+		const auto w = [](const u64 v) { return static_cast<u64>(static_cast<i64>(static_cast<i32>(static_cast<u32>(v)))); };
+		const u64 imm = static_cast<u64>(d.imm);
+		switch (op)
+		{
+			case Op::LI:    alu(d, [imm](u64, u64) { return imm; }); break;
+			case Op::ADDI:  alu(d, [imm](u64 a, u64) { return a + imm; }); break;
+			case Op::SLLI:  alu(d, [imm](u64 a, u64) { return a << imm; }); break;
+			case Op::SLTI:  alu(d, [imm](u64 a, u64) { return u64{static_cast<i64>(a) < static_cast<i64>(imm)}; }); break;
+			case Op::SLTIU: alu(d, [imm](u64 a, u64) { return u64{a < imm}; }); break;
+			case Op::XORI:  alu(d, [imm](u64 a, u64) { return a ^ imm; }); break;
+			case Op::SRLI:  alu(d, [imm](u64 a, u64) { return a >> imm; }); break;
+			case Op::SRAI:  alu(d, [imm](u64 a, u64) { return static_cast<u64>(static_cast<i64>(a) >> imm); }); break;
+			case Op::ORI:   alu(d, [imm](u64 a, u64) { return a | imm; }); break;
+			case Op::ANDI:  alu(d, [imm](u64 a, u64) { return a & imm; }); break;
+			case Op::ADDIW: alu(d, [imm, w](u64 a, u64) { return w(a + imm); }); break;
+			case Op::SLLIW: alu(d, [imm, w](u64 a, u64) { return w(a << imm); }); break;
+			case Op::SRLIW: alu(d, [imm, w](u64 a, u64) { return w(static_cast<u32>(a) >> imm); }); break;
+			case Op::SRAIW: alu(d, [imm](u64 a, u64) { return static_cast<u64>(static_cast<i64>(static_cast<i32>(a) >> imm)); }); break;
+			case Op::ADD:   alu(d, [](u64 a, u64 b) { return a + b; }); break;
+			case Op::SUB:   alu(d, [](u64 a, u64 b) { return a - b; }); break;
+			case Op::SLL:   alu(d, [](u64 a, u64 b) { return a << (b & 0x3f); }); break;
+			case Op::SLT:   alu(d, [](u64 a, u64 b) { return u64{static_cast<i64>(a) < static_cast<i64>(b)}; }); break;
+			case Op::SLTU:  alu(d, [](u64 a, u64 b) { return u64{a < b}; }); break;
+			case Op::XOR:   alu(d, [](u64 a, u64 b) { return a ^ b; }); break;
+			case Op::SRL:   alu(d, [](u64 a, u64 b) { return a >> (b & 0x3f); }); break;
+			case Op::SRA:   alu(d, [](u64 a, u64 b) { return static_cast<u64>(static_cast<i64>(a) >> (b & 0x3f)); }); break;
+			case Op::OR:    alu(d, [](u64 a, u64 b) { return a | b; }); break;
+			case Op::AND:   alu(d, [](u64 a, u64 b) { return a & b; }); break;
+			case Op::MUL:   alu(d, [](u64 a, u64 b) { return a * b; }); break;
+			case Op::ADDW:  alu(d, [w](u64 a, u64 b) { return w(a + b); }); break;
+			case Op::SUBW:  alu(d, [w](u64 a, u64 b) { return w(a - b); }); break;
+			case Op::SLLW:  alu(d, [w](u64 a, u64 b) { return w(a << (b & 0x1f)); }); break;
+			case Op::SRLW:  alu(d, [w](u64 a, u64 b) { return w(static_cast<u32>(a) >> (b & 0x1f)); }); break;
+			case Op::SRAW:  alu(d, [](u64 a, u64 b) { return static_cast<u64>(static_cast<i64>(static_cast<i32>(a) >> (b & 0x1f))); }); break;
+			case Op::MULW:  alu(d, [w](u64 a, u64 b) { return w(a * b); }); break;
+			case Op::BEQ:   branch(d, pc, [](u64 a, u64 b) { return a == b; }); break;
+			case Op::BNE:   branch(d, pc, [](u64 a, u64 b) { return a != b; }); break;
+			case Op::BLT:   branch(d, pc, [](u64 a, u64 b) { return static_cast<i64>(a) < static_cast<i64>(b); }); break;
+			case Op::BGE:   branch(d, pc, [](u64 a, u64 b) { return static_cast<i64>(a) >= static_cast<i64>(b); }); break;
+			case Op::BLTU:  branch(d, pc, [](u64 a, u64 b) { return a < b; }); break;
+			case Op::BGEU:  branch(d, pc, [](u64 a, u64 b) { return a >= b; }); break;
+			case Op::LB:    load<i8>(d); break;
+			case Op::LH:    load<i16>(d); break;
+			case Op::LW:    load<i32>(d); break;
+			case Op::LD:    load<u64>(d); break;
+			case Op::LBU:   load<u8>(d); break;
+			case Op::LHU:   load<u16>(d); break;
+			case Op::LWU:   load<u32>(d); break;
+			case Op::SB:    store<u8>(d); break;
+			case Op::SH:    store<u16>(d); break;
+			case Op::SW:    store<u32>(d); break;
+			case Op::SD:    store<u64>(d); break;
+			case Op::INTERP:
+			case Op::DECODE:
+				throw std::runtime_error(std::format("Unsupported instruction for lockstep lanes at pc=0x{:x}", pc));
+			default: // jumps, high multiplies, divides: one lane at a time on the scalar VM
+				scalar(d, pc);
+				break;
+		}
+		xs[0] = {};
+	}
+
+	// rd = f(rs1, rs2) in every lane in mask
+	//   the sources are copied, so the loop vectorizes whichever registers alias
+	template<typename F>
+	TINYRISCV64_INLINE void alu(const DecodedOp& d, F f)
+	{
+		const Lanes a = xs[d.rs1], b = xs[d.rs2];
+		auto& rd = xs[d.rd];
+		for (size_t l = 0; l < lanes; ++l)
+		{
+			rd[l] = (f(a[l], b[l]) & mask[l]) | (rd[l] & ~mask[l]);
+		}
+	}
+
+#if defined(__AVX2__)
+	// The AVX2 form of exec_lanes(), four lanes to a vector; returns false for ops it has none for
+	//   AVX2 has no 64 bit arithmetic shift right, multiply or unsigned compare: they're made of other ops
+	bool exec_vector(const Op op, const DecodedOp& d, const u64 pc)
+	{
+		const __m256i imm = _mm256_set1_epi64x(d.imm);
+		const __m128i shamt = _mm_cvtsi64_si128(d.imm);
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i sign = _mm256_set1_epi64x(static_cast<i64>(1ull << 63));
+		// Sign-extend the low 32 bits of each lane
+		const auto w = [](const __m256i v) {
+			return _mm256_blend_epi32(v, _mm256_shuffle_epi32(_mm256_srai_epi32(v, 31), _MM_SHUFFLE(2,2,0,0)), 0xAA);
+		};
+		const auto sra = [zero](const __m256i v, const __m256i n) {
+			return _mm256_or_si256(_mm256_srlv_epi64(v, n),
+				_mm256_sllv_epi64(_mm256_cmpgt_epi64(zero, v), _mm256_sub_epi64(_mm256_set1_epi64x(64), n)));
+		};
+		const auto mul = [](const __m256i a, const __m256i b) {
+			const __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+			return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+		};
+		const auto lt = [](const __m256i a, const __m256i b) { return _mm256_cmpgt_epi64(b, a); };
+		const auto ltu = [sign](const __m256i a, const __m256i b) {
+			return _mm256_cmpgt_epi64(_mm256_xor_si256(b, sign), _mm256_xor_si256(a, sign));
+		};
+		const auto bit = [](const __m256i m) { return _mm256_srli_epi64(m, 63); };
+		const auto n6 = [](const __m256i b) { return _mm256_and_si256(b, _mm256_set1_epi64x(0x3f)); };
+		const auto n5 = [](const __m256i b) { return _mm256_and_si256(b, _mm256_set1_epi64x(0x1f)); };
+		switch (op)
+		{
+			case Op::LI:    alu_vector(d, [&](__m256i, __m256i) { return imm; }); break;
+			case Op::ADDI:  alu_vector(d, [&](__m256i a, __m256i) { return _mm256_add_epi64(a, imm); }); break;
+			case Op::SLLI:  alu_vector(d, [&](__m256i a, __m256i) { return _mm256_sll_epi64(a, shamt); }); break;
+			case Op::SLTI:  alu_vector(d, [&](__m256i a, __m256i) { return bit(lt(a, imm)); }); break;
+			case Op::SLTIU: alu_vector(d, [&](__m256i a, __m256i) { return bit(ltu(a, imm)); }); break;
+			case Op::XORI:  alu_vector(d, [&](__m256i a, __m256i) { return _mm256_xor_si256(a, imm); }); break;
+			case Op::SRLI:  alu_vector(d, [&](__m256i a, __m256i) { return _mm256_srl_epi64(a, shamt); }); break;
+			case Op::SRAI:  alu_vector(d, [&](__m256i a, __m256i) { return sra(a, imm); }); break;
+			case Op::ORI:   alu_vector(d, [&](__m256i a, __m256i) { return _mm256_or_si256(a, imm); }); break;
+			case Op::ANDI:  alu_vector(d, [&](__m256i a, __m256i) { return _mm256_and_si256(a, imm); }); break;
+			case Op::ADDIW: alu_vector(d, [&](__m256i a, __m256i) { return w(_mm256_add_epi64(a, imm)); }); break;
+			case Op::SLLIW: alu_vector(d, [&](__m256i a, __m256i) { return w(_mm256_sll_epi32(a, shamt)); }); break;
+			case Op::SRLIW: alu_vector(d, [&](__m256i a, __m256i) { return w(_mm256_srl_epi32(a, shamt)); }); break;
+			case Op::SRAIW: alu_vector(d, [&](__m256i a, __m256i) { return w(_mm256_sra_epi32(a, shamt)); }); break;
+			case Op::ADD:   alu_vector(d, [&](__m256i a, __m256i b) { return _mm256_add_epi64(a, b); }); break;
+			case Op::SUB:   alu_vector(d, [&](__m256i a, __m256i b) { return _mm256_sub_epi64(a, b); }); break;
+			case Op::SLL:   alu_vector(d, [&](__m256i a, __m256i b) { return _mm256_sllv_epi64(a, n6(b)); }); break;
+			case Op::SLT:   alu_vector(d, [&](__m256i a, __m256i b) { return bit(lt(a, b)); }); break;
+			case Op::SLTU:  alu_vector(d, [&](__m256i a, __m256i b) { return bit(ltu(a, b)); }); break;
+			case Op::XOR:   alu_vector(d, [&](__m256i a, __m256i b) { return _mm256_xor_si256(a, b); }); break;
+			case Op::SRL:   alu_vector(d, [&](__m256i a, __m256i b) { return _mm256_srlv_epi64(a, n6(b)); }); break;
+			case Op::SRA:   alu_vector(d, [&](__m256i a, __m256i b) { return sra(a, n6(b)); }); break;
+			case Op::OR:    alu_vector(d, [&](__m256i a, __m256i b) { return _mm256_or_si256(a, b); }); break;
+			case Op::AND:   alu_vector(d, [&](__m256i a, __m256i b) { return _mm256_and_si256(a, b); }); break;
+			case Op::MUL:   alu_vector(d, [&](__m256i a, __m256i b) { return mul(a, b); }); break;
+			case Op::ADDW:  alu_vector(d, [&](__m256i a, __m256i b) { return w(_mm256_add_epi64(a, b)); }); break;
+			case Op::SUBW:  alu_vector(d, [&](__m256i a, __m256i b) { return w(_mm256_sub_epi64(a, b)); }); break;
+			case Op::SLLW:  alu_vector(d, [&](__m256i a, __m256i b) { return w(_mm256_sllv_epi32(a, n5(b))); }); break;
+			case Op::SRLW:  alu_vector(d, [&](__m256i a, __m256i b) { return w(_mm256_srlv_epi32(a, n5(b))); }); break;
+			case Op::SRAW:  alu_vector(d, [&](__m256i a, __m256i b) { return w(_mm256_srav_epi32(a, n5(b))); }); break;
+			case Op::MULW:  alu_vector(d, [&](__m256i a, __m256i b) { return w(_mm256_mullo_epi32(a, b)); }); break;
+			case Op::BEQ:   branch_vector<false>(d, pc, [&](__m256i a, __m256i b) { return _mm256_cmpeq_epi64(a, b); }); break;
+			case Op::BNE:   branch_vector<true>(d, pc, [&](__m256i a, __m256i b) { return _mm256_cmpeq_epi64(a, b); }); break;
+			case Op::BLT:   branch_vector<false>(d, pc, [&](__m256i a, __m256i b) { return lt(a, b); }); break;
+			case Op::BGE:   branch_vector<true>(d, pc, [&](__m256i a, __m256i b) { return lt(a, b); }); break;
+			case Op::BLTU:  branch_vector<false>(d, pc, [&](__m256i a, __m256i b) { return ltu(a, b); }); break;
+			case Op::BGEU:  branch_vector<true>(d, pc, [&](__m256i a, __m256i b) { return ltu(a, b); }); break;
+			default:
+				return false;
+		}
+		return true;
+	}
+
+	static __m256i lanes_at(const Lanes& r, const size_t i) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(r.data()) + i); }
+
+	// rd = f(rs1, rs2) in every lane in mask, a vector at a time
+	template<typename F>
+	TINYRISCV64_INLINE void alu_vector(const DecodedOp& d, F f)
+	{
+		__m256i out[lanes / 4];
+		for (size_t i = 0; i < lanes / 4; ++i) // both sources are read before rd, which may be one of them
+			out[i] = _mm256_blendv_epi8(lanes_at(xs[d.rd], i), f(lanes_at(xs[d.rs1], i), lanes_at(xs[d.rs2], i)), lanes_at(mask, i));
+		for (size_t i = 0; i < lanes / 4; ++i)
+			_mm256_store_si256(reinterpret_cast<__m256i*>(xs[d.rd].data()) + i, out[i]);
+	}
+
+	// branch(), a vector at a time, taken where cond(rs1, rs2) is all ones (or all zeros, if Negate)
+	template<bool Negate, typename F>
+	TINYRISCV64_INLINE void branch_vector(const DecodedOp& d, const u64 pc, F cond)
+	{
+		const __m256i target = _mm256_set1_epi64x(d.imm), next = _mm256_set1_epi64x(pc + 4);
+		for (size_t i = 0; i < lanes / 4; ++i)
+		{
+			const __m256i c = cond(lanes_at(xs[d.rs1], i), lanes_at(xs[d.rs2], i));
+			const __m256i to = Negate ? _mm256_blendv_epi8(target, next, c) : _mm256_blendv_epi8(next, target, c);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(pcs.data()) + i, _mm256_blendv_epi8(lanes_at(pcs, i), to, lanes_at(mask, i)));
+		}
+	}
+#endif
+
+	// Go to the target in the lanes where taken(rs1, rs2), splitting them from the rest
+	template<typename F>
+	TINYRISCV64_INLINE void branch(const DecodedOp& d, const u64 pc, F taken)
+	{
+		const Lanes& a = xs[d.rs1];
+		const Lanes& b = xs[d.rs2];
+		for (size_t l = 0; l < lanes; ++l)
+		{
+			const u64 next = taken(a[l], b[l]) ? static_cast<u64>(d.imm) : pc + 4;
+			pcs[l] = (next & mask[l]) | (pcs[l] & ~mask[l]);
+		}
+	}
+
+	// Load rd from rs1+imm in every lane in mask: side by side where they all address the same stack word
+	template<typename T>
+	void load(const DecodedOp& d)
+	{
+		using Extended = std::conditional_t<std::is_signed_v<T>, i64, u64>;
+		auto& rd = xs[d.rd];
+		if (const u8* const row = uniform_row<T>(d))
+		{
+			#if defined(__AVX2__)
+			// Each lane's u64 shifted down to the value, then extended from its top bit
+			const u64 off = word_offset(xs[d.rs1][first_lane()] + d.imm);
+			const __m128i down = _mm_cvtsi64_si128(8 * off), up = _mm_cvtsi64_si128(64 - 8 * sizeof(T));
+			const __m256i sign_fill = _mm256_set1_epi64x(64 - 8 * sizeof(T));
+			__m256i out[lanes / 4];
+			for (size_t i = 0; i < lanes / 4; ++i)
+			{
+				__m256i v = _mm256_sll_epi64(_mm256_srl_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row - off) + i), down), up);
+				v = std::is_signed_v<T>
+					? _mm256_or_si256(_mm256_srl_epi64(v, up), _mm256_sllv_epi64(_mm256_cmpgt_epi64(_mm256_setzero_si256(), v), sign_fill))
+					: _mm256_srl_epi64(v, up);
+				out[i] = _mm256_blendv_epi8(lanes_at(rd, i), v, lanes_at(mask, i));
+			}
+			for (size_t i = 0; i < lanes / 4; ++i)
+				_mm256_store_si256(reinterpret_cast<__m256i*>(rd.data()) + i, out[i]);
+			#else
+			for (size_t l = 0; l < lanes; ++l)
+			{
+				T value;
+				std::memcpy(&value, row + l*8, sizeof(T));
+				rd[l] = (static_cast<u64>(static_cast<Extended>(value)) & mask[l]) | (rd[l] & ~mask[l]);
+			}
+			#endif
+			return;
+		}
+		for (size_t l = 0; l < lanes; ++l)
+		{
+			if (!mask[l])
+				continue;
+			const u64 addr = xs[d.rs1][l] + d.imm;
+			T value;
+			if (in_stack<T>(addr))
+				for (size_t i = 0; i < sizeof(T); ++i)
+					reinterpret_cast<u8*>(&value)[i] = *stack_byte(l, addr + i);
+			else
+				std::memcpy(&value, lane_ptr<T>(l, addr, false), sizeof(T));
+			rd[l] = static_cast<u64>(static_cast<Extended>(value));
+		}
+	}
+
+	// Store rs2 at rs1+imm in every lane in mask
+	template<typename T>
+	void store(const DecodedOp& d)
+	{
+		const Lanes& rs2 = xs[d.rs2];
+		if (u8* const row = uniform_row<T>(d))
+		{
+			#if defined(__AVX2__)
+			// The value's bytes blended into each lane's u64
+			const u64 off = word_offset(xs[d.rs1][first_lane()] + d.imm);
+			const __m128i up = _mm_cvtsi64_si128(8 * off);
+			const __m256i bytes = _mm256_set1_epi64x(static_cast<i64>((sizeof(T) == 8 ? ~0ull : (1ull << 8 * sizeof(T)) - 1) << 8 * off));
+			for (size_t i = 0; i < lanes / 4; ++i)
+			{
+				__m256i* const at = reinterpret_cast<__m256i*>(row - off) + i;
+				_mm256_storeu_si256(at, _mm256_blendv_epi8(_mm256_loadu_si256(at), _mm256_sll_epi64(lanes_at(rs2, i), up),
+					_mm256_and_si256(bytes, lanes_at(mask, i))));
+			}
+			#else
+			for (size_t l = 0; l < lanes; ++l)
+			{
+				if (mask[l])
+				{
+					const T value = static_cast<T>(rs2[l]);
+					std::memcpy(row + l*8, &value, sizeof(T));
+				}
+			}
+			#endif
+			return;
+		}
+		for (size_t l = 0; l < lanes; ++l)
+		{
+			if (!mask[l])
+				continue;
+			const u64 addr = xs[d.rs1][l] + d.imm;
+			const T value = static_cast<T>(rs2[l]);
+			if (in_stack<T>(addr))
+				for (size_t i = 0; i < sizeof(T); ++i)
+					*stack_byte(l, addr + i) = reinterpret_cast<const u8*>(&value)[i];
+			else
+				std::memcpy(lane_ptr<T>(l, addr, true), &value, sizeof(T));
+		}
+	}
+
+	// Where all the lanes in mask access the same stack address, within one u64, the lanes' first byte
+	//   of it (one lane's next is 8 bytes on); otherwise nullptr
+	template<typename T>
+	TINYRISCV64_INLINE u8* uniform_row(const DecodedOp& d)
+	{
+		const Lanes& base = xs[d.rs1];
+		const size_t first = first_lane();
+		const u64 addr = base[first] + d.imm;
+		bool same = true;
+		#if defined(__AVX2__)
+		const __m256i at = _mm256_set1_epi64x(base[first]);
+		for (size_t i = 0; i < lanes / 4; ++i)
+			same &= _mm256_testc_si256(_mm256_cmpeq_epi64(lanes_at(base, i), at), lanes_at(mask, i));
+		#else
+		for (size_t l = 0; l < lanes; ++l)
+			same &= (base[l] == base[first]) | !mask[l];
+		#endif
+		if (!same || !in_stack<T>(addr) || word_offset(addr) + sizeof(T) > 8)
+			return nullptr;
+		return stack_row(addr) + word_offset(addr);
+	}
+
+	// The first lane in mask (there is always one)
+	TINYRISCV64_INLINE size_t first_lane() const
+	{
+		size_t first = 0;
+		while (!mask[first])
+			++first;
+		return first;
+	}
+
+	template<typename T>
+	TINYRISCV64_INLINE bool in_stack(const u64 addr) const
+	{
+		return addr >= s_beg && addr <= s_end - sizeof(T);
+	}
+
+	// The lanes' copies of the u64 of stack holding addr, one after another
+	//   u64s are counted down from s_end, which the stack pointer starts at, so sp-relative accesses line up
+	TINYRISCV64_INLINE u8* stack_row(const u64 addr)
+	{
+		return lane_stacks.data() + ((s_end - addr - 1) >> 3) * lanes * 8;
+	}
+	TINYRISCV64_INLINE u8* stack_byte(const size_t lane, const u64 addr)
+	{
+		return stack_row(addr) + lane*8 + word_offset(addr);
+	}
+	TINYRISCV64_INLINE u64 word_offset(const u64 addr) const
+	{
+		return (addr - s_end) & 7;
+	}
+
+	// Run an op that only touches registers and pc on the scalar VM, for each lane in mask
+	//   (these are never the first of a fused op, so d is the op's own slot)
+	void scalar(const DecodedOp& d, const u64 at)
+	{
+		for (size_t l = 0; l < lanes; ++l)
+		{
+			if (!mask[l])
+				continue;
+			x[0] = 0;
+			x[d.rd] = xs[d.rd][l];
+			x[d.rs1] = xs[d.rs1][l];
+			x[d.rs2] = xs[d.rs2][l];
+			pc = at;
+			execute_decoded(d);
+			xs[d.rd][l] = x[d.rd];
+			pcs[l] = pc;
+		}
+	}
+
+	// A lane's host memory for an access at addr outside the stack: its input, or the program (loads only)
+	template<typename T>
+	TINYRISCV64_INLINE u8* lane_ptr(const size_t lane, const u64 addr, const bool store)
+	{
+		if (addr > 0xFFFFFFFFFFFFFFF0ULL) [[unlikely]] //guard against wrap-around
+			throw std::runtime_error("Memory access out of bounds");
+		const u64 addr_max = addr + sizeof(T) - 1;
+		if (addr >= d_beg && addr_max < d_beg + lane_data[lane].size())
+			return lane_data[lane].data() + (addr - d_beg);
+		if (addr >= p_beg && addr_max < p_end)
+		{
+			if (store) [[unlikely]]
+				throw std::runtime_error("Lockstep lanes can't write program memory");
+			if (addr >= shared_end)
+				return program.data() + (addr - shared_end);
+			if (addr_max < shared_end)
+				return const_cast<u8*>(image->bytes.data()) + (addr - p_beg);
+		}
+		[[unlikely]] throw std::runtime_error("Memory access out of bounds");
+	}
+};
+
+} // namespace TinyRISCV64
+
+#endif // TINYLOCKSTEPRISCV64_H
@@ -44,6 +44,27 @@
 #include <array>
 #include <format>
 #include <atomic>
+#include <algorithm>
+#include <memory>
+#include <map>
+#include <type_traits>
+#include <optional>
+#include <numeric>
+#include <string_view>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <iterator>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) && defined(__linux__)
+#include <signal.h>
+#include <setjmp.h>
+#endif
 
 namespace TinyRISCV64
 {
@@ -57,200 +78,3386 @@ using i16 = int16_t;
 using i32 = int32_t;
 using i64 = int64_t;
 
+// Execution engines selectable per VM instance
+enum class Engine : u8
+{
+	Interpreter, // Fetch and decode every instruction as it retires
+	Predecode,   // Decode the program once at load time, then switch on the decoded ops
+	Threaded,    // Predecode with direct-threaded (computed goto) dispatch, if the compiler supports it
+	TailCall,    // Predecode with a tail-call per handler, guaranteed with [[clang::musttail]]
+	Block,       // Predecode, then run cached basic blocks chained to their successors
+	JIT          // Block, with hot blocks compiled to x86-64 machine code (x86-64 Linux only)
+};
+
+// Every engine, by name, in declaration order
+inline constexpr std::pair<const char*, Engine> engine_names[] = {
+	{"Interpreter", Engine::Interpreter},
+	{"Predecode", Engine::Predecode},
+	{"Threaded", Engine::Threaded},
+	{"TailCall", Engine::TailCall},
+	{"Block", Engine::Block},
+	{"JIT", Engine::JIT}
+};
+static_assert(std::size(engine_names) == static_cast<size_t>(Engine::JIT) + 1, "engine_names must name every Engine");
+
+// Host backing for guest memory, selectable per VM instance
+enum class Memory : u8
+{
+	Regions,     // Program, data and stack in their own host buffers; each access is checked against each region
+	Flat,        // One contiguous host arena with the same layout for the program and stack; each access is one bounds compare, plus one for the data regions
+	Guarded,     // A reserved 4 GiB host range with inaccessible pages between the regions; stray accesses fault
+	Paged        // Sparse 4 KiB pages with R/W/X permissions behind a software TLB; more can be mapped (see VM::map_pages())
+};
+
+// Every memory backing, by name, in declaration order
+inline constexpr std::pair<const char*, Memory> memory_names[] = {
+	{"Regions", Memory::Regions},
+	{"Flat", Memory::Flat},
+	{"Guarded", Memory::Guarded},
+	{"Paged", Memory::Paged}
+};
+static_assert(std::size(memory_names) == static_cast<size_t>(Memory::Paged) + 1, "memory_names must name every Memory");
+
+// Why VM::run() stopped
+enum class RunStatus : u8
+{
+	Halted,        // The program exited or returned, or halt_program() stopped it
+	FuelExhausted, // The fuel ran out before the next instruction; run() again to continue
+	Trap,          // The guest faulted (see VM::trap_reason()), leaving pc where it did
+	Yield          // The guest yielded (see VM::yield_program()); run() again to continue
+};
+
+// Guest page permissions (Memory::Paged), combined with |
+enum class Perm : u8
+{
+	None = 0,
+	R = 1,
+	W = 2,
+	X = 4,
+	RW = R | W,
+	RX = R | X,
+	RWX = R | W | X
+};
+constexpr Perm operator|(const Perm a, const Perm b) { return static_cast<Perm>(static_cast<u8>(a) | static_cast<u8>(b)); }
+constexpr bool operator&(const Perm a, const Perm b) { return static_cast<u8>(a) & static_cast<u8>(b); }
+
+// A host buffer mapped as a guest data region (see VM::map_data_mem())
+struct DataBuffer
+{
+	std::span<u8> mem;
+	bool read_only = false;
+};
+
+// How VM::execute_batch() passes each input to the guest function, argument by argument (a0-a7)
+enum class BatchArg : u8
+{
+	Data, // The input's virtual addr
+	Size, // Its size in bytes
+	Out   // The addr of a zeroed u64 on the stack, for the function to store a result in
+};
+
+// What the guest function returned for one input of VM::execute_batch()
+struct BatchResult
+{
+	u64 value;                // a0
+	std::array<u64,8> outs;   // What it stored at its BatchArg::Out args, in argument order
+};
+
+// The guest function VM::call() runs, and its instruction budget
+struct CallTarget
+{
+	CallTarget(const u64 entry, const size_t max_instructions = 100000) : entry(entry), max_instructions(max_instructions) {}
+	u64 entry;
+	size_t max_instructions;
+};
+
+// A program's named functions and objects (see ElfVM::symbols()), indexed by name and by address:
+//   resolve names once and keep the addresses, and symbolize pcs (profiling samples, traps) by binary search
+class Symbols
+{
+public:
+	enum class Kind : u8
+	{
+		Other,    // A global label (e.g. a linker script's)
+		Object,
+		Function
+	};
+
+	struct Symbol
+	{
+		u64 addr;
+		u64 size;
+		u32 name;    // Offset of its NUL terminated name in the names (see name())
+		Kind kind;
+		bool global; // Global or weak, not local to its file
+	};
+
+	Symbols() = default;
+	Symbols(std::vector<Symbol> symbols, std::string names) : symbols(std::move(symbols)), names(std::move(names))
+	{
+		for (const auto& symbol : this->symbols)
+			if (symbol.name >= this->names.size() || this->names.back() != '\0')
+				throw std::invalid_argument(std::format("Symbol name offset {} is outside the names", symbol.name));
+		std::sort(this->symbols.begin(), this->symbols.end(),
+			[](const Symbol& a, const Symbol& b) { return a.addr != b.addr ? a.addr < b.addr : a.size < b.size; });
+		by_name.resize(this->symbols.size());
+		std::iota(by_name.begin(), by_name.end(), 0u);
+		std::sort(by_name.begin(), by_name.end(), [this](const u32 a, const u32 b)
+		{
+			const auto na = name(this->symbols[a]), nb = name(this->symbols[b]);
+			return na != nb ? na < nb : this->symbols[a].global > this->symbols[b].global;
+		});
+	}
+
+	// The named symbol's address (a global's ahead of any local of that name)
+	std::optional<u64> find(const std::string_view name) const
+	{
+		const auto it = std::lower_bound(by_name.begin(), by_name.end(), name,
+			[this](const u32 i, const std::string_view n) { return this->name(symbols[i]) < n; });
+		if (it == by_name.end() || this->name(symbols[*it]) != name)
+			return std::nullopt;
+		return symbols[*it].addr;
+	}
+
+	// find(), throwing if there's no such symbol
+	u64 address(const std::string_view name) const
+	{
+		if (const auto addr = find(name))
+			return *addr;
+		throw std::invalid_argument(std::format("No symbol named '{}'", name));
+	}
+
+	// The symbol spanning addr, or nullptr (labels without a size span nothing)
+	const Symbol* at(const u64 addr) const
+	{
+		auto it = std::upper_bound(symbols.begin(), symbols.end(), addr,
+			[](const u64 a, const Symbol& s) { return a < s.addr; });
+		while (it != symbols.begin())
+		{
+			--it;
+			if (addr - it->addr < it->size)
+				return &*it;
+			if (it->size)
+				break;
+		}
+		return nullptr;
+	}
+
+	std::string_view name(const Symbol& symbol) const { return names.data() + symbol.name; }
+
+	// addr as name+offset, or in hex if no symbol spans it
+	std::string describe(const u64 addr) const
+	{
+		const Symbol* const symbol = at(addr);
+		if (!symbol)
+			return std::format("0x{:x}", addr);
+		if (addr == symbol->addr)
+			return std::string(name(*symbol));
+		return std::format("{}+0x{:x}", name(*symbol), addr - symbol->addr);
+	}
+
+	// In address order
+	std::span<const Symbol> all() const { return symbols; }
+	size_t size() const { return symbols.size(); }
+	bool empty() const { return symbols.empty(); }
+
+private:
+	std::vector<Symbol> symbols; // By address, then size
+	std::string names;
+	std::vector<u32> by_name;    // Indexes of symbols, by name
+};
+
+// A program's code as checked when it was loaded (see VM::verified_code()): every instruction reached from
+//   the entry point (and the symbols' functions) decodes, and every direct branch or JAL target, and every
+//   fall-through, is a word of the code; a program that breaks this is refused by the load
+struct VerifiedCode
+{
+	u64 base = 0;              // Address of the first word of code
+	std::vector<bool> reached; // Words reached, by (addr-base)/4
+	std::vector<u64> indirect; // Starts of the reached blocks that end in an indirect jump (JALR), ascending
+	std::vector<u64> roots;    // Where verification started: the entry point, functions and any other roots
+
+	bool reached_at(const u64 addr) const
+	{
+		const u64 i = (addr - base) / 4;
+		return !(addr & 3) && i < reached.size() && reached[i];
+	}
+};
+
+// Hot-path helpers are forced inline: the dispatch loops outgrow the compiler's default inlining budget
+#if defined(__GNUC__)
+	#define TINYRISCV64_INLINE [[gnu::always_inline]] inline
+#elif defined(_MSC_VER)
+	#define TINYRISCV64_INLINE __forceinline
+#else
+	#define TINYRISCV64_INLINE inline
+#endif
+
+// Computed goto is a GCC/Clang extension; other compilers use the switch engine for Engine::Threaded
+#if defined(__GNUC__)
+	#define TINYRISCV64_COMPUTED_GOTO
+#endif
+
+// Without guaranteed tail calls, Engine::TailCall returns to a dispatch loop after each handler
+#if defined(__has_cpp_attribute)
+	#if __has_cpp_attribute(clang::musttail)
+		#define TINYRISCV64_MUSTTAIL [[clang::musttail]]
+	#endif
+#endif
+
+// The JIT targets x86-64 Linux; elsewhere, or with TINYRISCV64_NO_JIT defined, Engine::JIT runs as Engine::Block
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) && !defined(TINYRISCV64_NO_JIT)
+	#define TINYRISCV64_JIT
+#endif
+
+// Memory::Guarded needs mmap and a SIGSEGV handler; elsewhere, or with TINYRISCV64_NO_GUARD defined, it runs as Memory::Flat
+#if defined(__x86_64__) && defined(__linux__) && !defined(TINYRISCV64_NO_GUARD)
+	#define TINYRISCV64_GUARD
+#endif
+
+// Snapshots and ELF files are mapped from file, and large program and stack buffers are anonymous mappings,
+//   where mmap is available; elsewhere, or with TINYRISCV64_NO_MMAP defined, files are read in whole and buffers zero filled
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(TINYRISCV64_NO_MMAP)
+	#define TINYRISCV64_MMAP
+#endif
+
+// Decoded operations (see VM::decode()), then fused idioms (see VM::fuse_decoded())
+#define TINYRISCV64_OPS(X) \
+	X(LI)    X(JAL)   X(JALR)   X(BEQ)   X(BNE)   X(BLT)   X(BGE)   X(BLTU)  X(BGEU)  \
+	X(LB)    X(LH)    X(LW)     X(LD)    X(LBU)   X(LHU)   X(LWU)                     \
+	X(SB)    X(SH)    X(SW)     X(SD)                                                 \
+	X(ADDI)  X(SLLI)  X(SLTI)   X(SLTIU) X(XORI)  X(SRLI)  X(SRAI)  X(ORI)   X(ANDI)  \
+	X(ADDIW) X(SLLIW) X(SRLIW)  X(SRAIW)                                              \
+	X(ADD)   X(SUB)   X(SLL)    X(SLT)   X(SLTU)  X(XOR)   X(SRL)   X(SRA)   X(OR)    \
+	X(AND)   X(MUL)   X(MULH)   X(MULHSU) X(MULHU) X(DIV)  X(DIVU)  X(REM)   X(REMU)  \
+	X(ADDW)  X(SUBW)  X(SLLW)   X(SRLW)  X(SRAW)  X(MULW)  X(DIVW)  X(DIVUW) X(REMW)  \
+	X(REMUW) X(NOP)   X(INTERP) X(DECODE)                                             \
+	X(LI_ADDI) X(LI_ADDIW) X(LI_JALR) X(SLLI_SRLI) X(SRLI_SLLI) X(ADDI_BNE)           \
+	X(SLLI_SRLI_OR) X(SLLI_SRLI_ADD) X(SLLI_SRLI_XOR)                                 \
+	X(SRLI_SLLI_OR) X(SRLI_SLLI_ADD) X(SRLI_SLLI_XOR)
+
+#if defined(TINYRISCV64_JIT)
+// Minimal x86-64 assembler writing into an mmap'd code cache (kept W^X: writable only while emitting)
+class X64Emitter
+{
+public:
+	enum Reg : u8 { rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15 };
+	enum Cond : u8 { B = 2, AE = 3, E = 4, NE = 5, A = 7, L = 12, GE = 13 };
+	enum Alu : u8 { ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+	enum Shift : u8 { SHL = 4, SHR = 5, SAR = 7 };
+
+	explicit X64Emitter(const size_t capacity = 4UL*1024*1024)
+		: cap(capacity)
+	{
+		void* mem = mmap(nullptr, cap, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED)
+			throw std::runtime_error("Failed to allocate JIT code cache");
+		buf = static_cast<u8*>(mem);
+	}
+	~X64Emitter() { munmap(buf, cap); }
+	X64Emitter(const X64Emitter&) = delete;
+	X64Emitter& operator=(const X64Emitter&) = delete;
+
+	size_t space() const { return cap - len; }
+	size_t pos() const { return len; }
+	const u8* at(const size_t offset) const { return buf + offset; }
+	void clear() { len = 0; }
+	void writable(const bool w) { mprotect(buf, cap, w ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC); }
+
+	void emit8(const u8 b) { buf[len++] = b; }
+	void emit32(const u32 v) { std::memcpy(buf + len, &v, 4); len += 4; }
+	void emit64(const u64 v) { std::memcpy(buf + len, &v, 8); len += 8; }
+
+	// Register-direct and [base+disp] operand encodings
+	void rex(const bool w, const u8 reg, const u8 base) { const u8 r = 0x40 | (w << 3) | ((reg >> 3) << 2) | (base >> 3); if (r != 0x40) emit8(r); }
+	void modrm_rr(const u8 reg, const u8 rm) { emit8(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+	void modrm_mem(const u8 reg, const u8 base, const i32 disp)
+	{
+		const u8 mod = (disp == 0 && (base & 7) != rbp) ? 0 : (disp >= -128 && disp <= 127) ? 1 : 2;
+		emit8((mod << 6) | ((reg & 7) << 3) | (base & 7));
+		if ((base & 7) == rsp) emit8(0x24);
+		if (mod == 1) emit8(static_cast<u8>(disp));
+		else if (mod == 2) emit32(static_cast<u32>(disp));
+	}
+	void op_rr(const bool w, const u8 opc, const u8 reg, const u8 rm) { rex(w, reg, rm); emit8(opc); modrm_rr(reg, rm); }
+	void op_rm(const bool w, const u8 opc, const u8 reg, const u8 base, const i32 disp) { rex(w, reg, base); emit8(opc); modrm_mem(reg, base, disp); }
+	void op0f_rr(const bool w, const u8 opc, const u8 reg, const u8 rm) { rex(w, reg, rm); emit8(0x0F); emit8(opc); modrm_rr(reg, rm); }
+	void op0f_rm(const bool w, const u8 opc, const u8 reg, const u8 base, const i32 disp) { rex(w, reg, base); emit8(0x0F); emit8(opc); modrm_mem(reg, base, disp); }
+
+	void mov(const Reg dst, const Reg src) { if (dst != src) op_rr(true, 0x89, src, dst); }
+	void load(const Reg dst, const Reg base, const i32 disp) { op_rm(true, 0x8B, dst, base, disp); }
+	void store(const Reg base, const i32 disp, const Reg src) { op_rm(true, 0x89, src, base, disp); }
+	void mov_imm(const Reg dst, const u64 imm)
+	{
+		if (static_cast<i64>(imm) == static_cast<i32>(imm)) { rex(true, 0, dst); emit8(0xC7); modrm_rr(0, dst); emit32(static_cast<u32>(imm)); }
+		else { rex(true, 0, dst); emit8(0xB8 | (dst & 7)); emit64(imm); }
+	}
+	void store_imm(const Reg base, const i32 disp, const i32 imm) { op_rm(true, 0xC7, 0, base, disp); emit32(static_cast<u32>(imm)); }
+	void lea(const Reg dst, const Reg base, const i32 disp) { op_rm(true, 0x8D, dst, base, disp); }
+
+	void alu(const Alu op, const Reg dst, const Reg src, const bool w = true) { op_rr(w, static_cast<u8>(op << 3 | 1), src, dst); }
+	void alu_imm(const Alu op, const Reg dst, const i32 imm, const bool w = true) { rex(w, 0, dst); emit8(0x81); modrm_rr(op, dst); emit32(static_cast<u32>(imm)); }
+	void alu_mem(const Alu op, const Reg dst, const Reg base, const i32 disp) { op_rm(true, static_cast<u8>(op << 3 | 3), dst, base, disp); }
+	void shift_imm(const Shift op, const Reg dst, const u8 imm, const bool w = true) { rex(w, 0, dst); emit8(0xC1); modrm_rr(op, dst); emit8(imm); }
+	void shift_cl(const Shift op, const Reg dst, const bool w = true) { rex(w, 0, dst); emit8(0xD3); modrm_rr(op, dst); }
+	void imul(const Reg dst, const Reg src, const bool w = true) { op0f_rr(w, 0xAF, dst, src); }
+	void mul_rdx_rax(const Reg src, const bool is_signed) { rex(true, 0, src); emit8(0xF7); modrm_rr(is_signed ? 5 : 4, src); }
+	void movsxd(const Reg dst, const Reg src) { op_rr(true, 0x63, dst, src); }
+	void setcc_movzx(const Cond cc, const Reg dst) { op0f_rr(false, 0x90 | cc, 0, dst); op0f_rr(false, 0xB6, dst, dst); }
+	void cmov(const Cond cc, const Reg dst, const Reg src) { op0f_rr(true, 0x40 | cc, dst, src); }
+	void push(const Reg r) { rex(false, 0, r); emit8(0x50 | (r & 7)); }
+	void pop(const Reg r) { rex(false, 0, r); emit8(0x58 | (r & 7)); }
+	void call(const Reg r) { rex(false, 0, r); emit8(0xFF); modrm_rr(2, r); }
+	void ret() { emit8(0xC3); }
+
+	// rel32 jumps: return the offset of the displacement so it can be bound later
+	size_t jcc(const Cond cc) { emit8(0x0F); emit8(0x80 | cc); emit32(0); return len - 4; }
+	size_t jmp() { emit8(0xE9); emit32(0); return len - 4; }
+	void bind(const size_t fixup) { bind(fixup, len); }
+	void bind(const size_t fixup, const size_t target) { const u32 rel = static_cast<u32>(target - (fixup + 4)); std::memcpy(buf + fixup, &rel, 4); }
+
+private:
+	u8* buf;
+	const size_t cap;
+	size_t len = 0;
+};
+#endif
+
+// Sparse guest memory for Memory::Paged: mappings of host memory, or of zero-filled memory
+//   allocated a page at a time when first touched, with 4 KiB pages looked up in a four level
+//   radix table over a 48 bit address space as they are touched, behind a direct-mapped TLB
+//   so that an access to a cached page is one tag compare
+//   pages of memory the table owns (see adopt()) are shared copy-on-write by fork()
+class PageTable
+{
+public:
+	static constexpr u64 page_bits = 12;
+	static constexpr u64 page_size = 1ULL << page_bits;
+	static constexpr u64 page_mask = page_size - 1;
+	static constexpr u64 va_bits = 48;
+	static constexpr size_t tlb_size = 256;
+
+	// A cached page: its address in each tag the page allows, no_page in the others
+	struct TlbEntry
+	{
+		u64 read, write, exec; // Tags
+		u64 host;              // Host address of virtual 0 for this page
+	};
+	static constexpr u64 no_page = ~0ULL;
+
+	PageTable() { flush(); }
+
+	// Map [vaddr, vaddr+size) to host memory at mem, or to zero-filled memory if mem is nullptr
+	//   a page that isn't fully covered only allows access to the covered bytes,
+	//   and can't be shared with another mapping
+	void map(const u64 vaddr, u8* const mem, const u64 size, const Perm perm)
+	{
+		if (size == 0)
+			return;
+		const u64 end = vaddr + size;
+		if (end < vaddr || (end - 1) >> va_bits)
+			throw std::invalid_argument(std::format("Mapping [0x{:x}, 0x{:x}) outside the {} bit address space", vaddr, end, va_bits));
+		auto next = mappings.lower_bound(vaddr & ~page_mask);
+		if (next != mappings.begin() && page_up(std::prev(next)->second.end) > (vaddr & ~page_mask))
+			--next;
+		if (next != mappings.end() && (next->first & ~page_mask) < page_up(end))
+			throw std::invalid_argument(std::format("Mapping [0x{:x}, 0x{:x}) overlaps the mapping at 0x{:x}", vaddr, end, next->first));
+		mappings.emplace(vaddr, Mapping{end, mem ? reinterpret_cast<u64>(mem) - vaddr : 0, perm, !mem, false, false});
+	}
+
+	// Take shared ownership of the host memory mapped at [vaddr, vaddr+size), so that fork() can share it
+	//   the memory mustn't be written other than through the table from then on
+	void adopt(const u64 vaddr, const u64 size, std::shared_ptr<const void> owner)
+	{
+		split(vaddr);
+		split(vaddr + size);
+		for (auto m = mappings.lower_bound(vaddr); m != mappings.end() && m->first < vaddr + size; ++m)
+			m->second.owned = true;
+		for_pages(vaddr & ~page_mask, page_up(vaddr + size), [](Page& p) { p.owned = true; });
+		owners.push_back(std::move(owner));
+	}
+
+	// A copy of the table, sharing the writable pages of owned memory copy-on-write: the first store
+	//   to such a page on either side copies it; other mappings are aliased by both tables
+	std::unique_ptr<PageTable> fork()
+	{
+		auto copy = std::make_unique<PageTable>();
+		for (auto& [vaddr, m] : mappings)
+			m.cow = m.owned && (m.perm & Perm::W);
+		copy->mappings = mappings;
+		copy->owners = owners;
+		for (size_t i = 0; i < root.size(); ++i)
+		{
+			if (!root[i]) continue;
+			auto& l3 = copy->root[i] = std::make_unique<Table<Table<Leaf>>>();
+			for (size_t j = 0; j < root[i]->size(); ++j)
+			{
+				if (!(*root[i])[j]) continue;
+				auto& l2 = (*l3)[j] = std::make_unique<Table<Leaf>>();
+				for (size_t k = 0; k < (*root[i])[j]->size(); ++k)
+				{
+					auto& leaf = (*(*root[i])[j])[k];
+					if (!leaf) continue;
+					for (Page& p : leaf->page)
+						p.cow = p.cow || (p.owned && (p.perm & Perm::W));
+					(*l2)[k] = std::make_unique<Leaf>(*leaf);
+				}
+			}
+		}
+		flush(); // cached write tags no longer hold for shared pages
+		return copy;
+	}
+
+	// Copy [vaddr, vaddr+size) out regardless of permissions, leaving bytes of unmapped pages as they are
+	void peek(const u64 vaddr, u8* const buf, const u64 size)
+	{
+		for (u64 a = vaddr; a < vaddr + size; a = (a & ~page_mask) + page_size)
+		{
+			const Page* const p = page(a);
+			const u64 beg = a & ~page_mask;
+			const u64 lo = std::max<u64>(a, beg + (p ? p->lo : 0));
+			const u64 hi = std::min<u64>(vaddr + size, beg + (p ? p->hi : 0));
+			if (lo < hi)
+				std::memcpy(buf + (lo - vaddr), reinterpret_cast<u8*>(p->host + lo), hi - lo);
+		}
+	}
+
+	// Unmap every page overlapping [vaddr, vaddr+size)
+	void unmap(const u64 vaddr, const u64 size)
+	{
+		const u64 beg = vaddr & ~page_mask, end = page_up(vaddr + size);
+		split(beg);
+		split(end);
+		mappings.erase(mappings.lower_bound(beg), mappings.lower_bound(end));
+		for_pages(beg, end, [](Page& p) { p = Page{}; });
+		flush();
+	}
+
+	// Change the permissions of every mapped page overlapping [vaddr, vaddr+size)
+	void protect(const u64 vaddr, const u64 size, const Perm perm)
+	{
+		const u64 beg = vaddr & ~page_mask, end = page_up(vaddr + size);
+		split(beg);
+		split(end);
+		for (auto m = mappings.lower_bound(beg); m != mappings.end() && m->first < end; ++m)
+			m->second.perm = perm;
+		for_pages(beg, end, [perm](Page& p) { p.perm = perm; });
+		flush();
+	}
+
+	// Whether all of [addr, addr+len) (at most two pages) can be accessed with perm
+	bool allows(const u64 addr, const size_t len, const Perm perm)
+	{
+		for (u64 a = addr; a < addr + len; a = (a & ~page_mask) + page_size)
+		{
+			const Page* const p = page(a);
+			const u64 end = std::min((a & ~page_mask) + page_size, addr + len);
+			if (!p || !(p->perm & perm) || (a & page_mask) < p->lo || end - (a & ~page_mask) > p->hi)
+				return false;
+		}
+		return true;
+	}
+
+	template<typename T>
+	TINYRISCV64_INLINE T load(const u64 addr)
+	{
+		T value;
+		const TlbEntry& e = tlb[(addr >> page_bits) & (tlb_size - 1)];
+		if (e.read == (addr & ~page_mask) && (addr & page_mask) <= page_size - sizeof(T)) [[likely]]
+			std::memcpy(&value, reinterpret_cast<u8*>(e.host + addr), sizeof(T));
+		else
+			copy_slow(addr, reinterpret_cast<u8*>(&value), sizeof(T), Perm::R);
+		return value;
+	}
+
+	template<typename T>
+	TINYRISCV64_INLINE void store(const u64 addr, T value)
+	{
+		const TlbEntry& e = tlb[(addr >> page_bits) & (tlb_size - 1)];
+		if (e.write == (addr & ~page_mask) && (addr & page_mask) <= page_size - sizeof(T)) [[likely]]
+			std::memcpy(reinterpret_cast<u8*>(e.host + addr), &value, sizeof(T));
+		else
+			copy_slow(addr, reinterpret_cast<u8*>(&value), sizeof(T), Perm::W);
+	}
+
+	TINYRISCV64_INLINE u32 fetch(const u64 addr)
+	{
+		u32 word;
+		const TlbEntry& e = tlb[(addr >> page_bits) & (tlb_size - 1)];
+		if (e.exec == (addr & ~page_mask) && (addr & page_mask) <= page_size - 4) [[likely]]
+			std::memcpy(&word, reinterpret_cast<u8*>(e.host + addr), 4);
+		else
+			copy_slow(addr, reinterpret_cast<u8*>(&word), 4, Perm::X);
+		return word;
+	}
+
+	const TlbEntry* tlb_data() const { return tlb.data(); }
+
+private:
+	struct Mapping
+	{
+		u64 end;        // One past the last mapped byte
+		u64 host;       // Host address of virtual 0 (unused if zero_fill)
+		Perm perm;
+		bool zero_fill; // Pages are allocated, zeroed, when first touched
+		bool owned;     // The host memory is kept by the table (see adopt())
+		bool cow;       // Pages are copied before their first store (see fork())
+	};
+
+	// A touched page, filled in from its mapping
+	struct Page
+	{
+		u64 host = 0;                 // Host address of virtual 0 for this page
+		u16 lo = 0, hi = 0;           // Accessible bytes [lo, hi) within the page; hi == 0 if not mapped
+		Perm perm = Perm::None;
+		bool owned = false;           // The table owns the storage (own, or adopted memory)
+		bool cow = false;             // Shared with a forked table: copied before its first store
+		std::shared_ptr<u8[]> own;    // Storage of a zero-filled or copied page
+	};
+	struct Leaf { std::array<Page, 512> page; };
+	template<typename T> using Table = std::array<std::unique_ptr<T>, 512>;
+
+	std::map<u64, Mapping> mappings; // By start address
+	std::vector<std::shared_ptr<const void>> owners; // Adopted host memory
+	Table<Table<Table<Leaf>>> root;
+	std::array<TlbEntry, tlb_size> tlb;
+
+	static u64 page_up(const u64 n) { return (n + page_mask) & ~page_mask; }
+
+	// The page at addr, filled in from its mapping if it hasn't been touched; nullptr if unmapped
+	Page* page(const u64 addr)
+	{
+		if (addr >> va_bits)
+			return nullptr;
+		const u64 n = addr >> page_bits;
+		auto& l3 = root[n >> 27 & 511];
+		if (!l3) l3 = std::make_unique<Table<Table<Leaf>>>();
+		auto& l2 = (*l3)[n >> 18 & 511];
+		if (!l2) l2 = std::make_unique<Table<Leaf>>();
+		auto& l1 = (*l2)[n >> 9 & 511];
+		if (!l1) l1 = std::make_unique<Leaf>();
+		Page& p = l1->page[n & 511];
+		if (p.hi)
+			return &p;
+
+		const u64 beg = addr & ~page_mask;
+		auto m = mappings.upper_bound(beg + page_mask);
+		if (m == mappings.begin() || (--m)->second.end <= beg)
+			return nullptr;
+		const Mapping& map = m->second;
+		p.lo = static_cast<u16>(std::max(m->first, beg) - beg);
+		p.hi = static_cast<u16>(std::min(map.end - beg, page_size));
+		p.perm = map.perm;
+		p.owned = map.owned || map.zero_fill;
+		p.cow = map.cow;
+		if (map.zero_fill)
+		{
+			p.own = std::make_shared<u8[]>(page_size); // value-initialised: zero filled
+			p.host = reinterpret_cast<u64>(p.own.get()) - beg;
+		}
+		else
+			p.host = map.host;
+		return &p;
+	}
+
+	// Split the mapping spanning the page boundary at addr in two
+	void split(const u64 addr)
+	{
+		auto m = mappings.lower_bound(addr);
+		if (m == mappings.begin() || (--m)->second.end <= addr)
+			return;
+		Mapping tail = m->second;
+		m->second.end = addr;
+		mappings.emplace(addr, tail);
+	}
+
+	// Visit the touched pages in [beg, end)
+	template<typename F>
+	void for_pages(const u64 beg, const u64 end, F&& f)
+	{
+		for (u64 n = beg >> page_bits; n < end >> page_bits && n < 1ULL << (va_bits - page_bits); ++n)
+		{
+			auto& l3 = root[n >> 27 & 511];
+			if (!l3) { n |= (1ULL << 27) - 1; continue; }
+			auto& l2 = (*l3)[n >> 18 & 511];
+			if (!l2) { n |= (1ULL << 18) - 1; continue; }
+			auto& l1 = (*l2)[n >> 9 & 511];
+			if (!l1) { n |= (1ULL << 9) - 1; continue; }
+			f(l1->page[n & 511]);
+		}
+	}
+
+	void flush()
+	{
+		tlb.fill({no_page, no_page, no_page, 0});
+	}
+
+	// Host address of [addr, addr+len) within one page, caching the page if it's fully accessible
+	u8* translate(const u64 addr, const size_t len, const Perm perm)
+	{
+		Page* const p = page(addr);
+		if (!p || (addr & page_mask) < p->lo || (addr & page_mask) + len > p->hi)
+			throw std::runtime_error("Memory access out of bounds");
+		if (!(p->perm & perm))
+			throw std::runtime_error("Memory access violates page permissions");
+		const u64 beg = addr & ~page_mask;
+		if (p->cow && (perm & Perm::W)) // first store since fork(): copy the page
+		{
+			auto copy = std::make_shared<u8[]>(page_size);
+			std::memcpy(copy.get() + p->lo, reinterpret_cast<u8*>(p->host + beg + p->lo), p->hi - p->lo);
+			p->own = std::move(copy);
+			p->host = reinterpret_cast<u64>(p->own.get()) - beg;
+			p->cow = false;
+		}
+		if (p->lo == 0 && p->hi == page_size)
+		{
+			TlbEntry& e = tlb[(addr >> page_bits) & (tlb_size - 1)];
+			e.read = p->perm & Perm::R ? beg : no_page;
+			e.write = p->perm & Perm::W && !p->cow ? beg : no_page;
+			e.exec = p->perm & Perm::X ? beg : no_page;
+			e.host = p->host;
+		}
+		return reinterpret_cast<u8*>(p->host + addr);
+	}
+
+	// A TLB miss, or an access crossing into the next page: both pages are checked before any byte is copied
+	void copy_slow(const u64 addr, u8* const buf, const size_t len, const Perm perm)
+	{
+		const size_t first = std::min<u64>(len, page_size - (addr & page_mask));
+		u8* const lo = translate(addr, first, perm);
+		u8* const hi = first < len ? translate(addr + first, len - first, perm) : nullptr;
+		if (perm & Perm::W)
+		{
+			std::memcpy(lo, buf, first);
+			if (hi) std::memcpy(hi, buf + first, len - first);
+		}
+		else
+		{
+			std::memcpy(buf, lo, first);
+			if (hi) std::memcpy(buf + first, hi, len - first);
+		}
+	}
+};
+
+#if defined(TINYRISCV64_GUARD)
+// Host backing for Memory::Guarded: a reservation covering every 32 bit guest address (plus a guard
+//   for accesses straddling the end) that is inaccessible except for the pages mapped for the program and stack
+//   a fault inside the arena during run() is reported as an out of bounds access, so loads and stores in it need no bounds checks
+class GuardedArena
+{
+public:
+	static constexpr u64 span = 1ULL << 32;  // Guest addresses covered
+	static constexpr u64 guard = 1ULL << 16; // Inaccessible tail past span
+
+	GuardedArena()
+	{
+		install_handler();
+		void* mem = mmap(nullptr, span + guard, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (mem == MAP_FAILED)
+			throw std::runtime_error("Failed to reserve guarded memory");
+		base = static_cast<u8*>(mem);
+	}
+	~GuardedArena() { munmap(base, span + guard); }
+	GuardedArena(const GuardedArena&) = delete;
+	GuardedArena& operator=(const GuardedArena&) = delete;
+
+	static u64 page() { static const u64 size = sysconf(_SC_PAGESIZE); return size; }
+	static u64 page_up(const u64 n) { return (n + page() - 1) & ~(page() - 1); }
+	u8* data() const { return base; }
+
+	// Make the pages covering [beg, end) readable and writable
+	void map(const u64 beg, const u64 end)
+	{
+		if (end <= beg)
+			return;
+		const u64 first = beg & ~(page() - 1);
+		if (mprotect(base + first, page_up(end) - first, PROT_READ | PROT_WRITE))
+			throw std::runtime_error("Failed to map guarded memory");
+	}
+
+	// Run f(), turning a fault inside the arena into "Memory access out of bounds"
+	//   the fault unwinds with siglongjmp, so f() must not fault with non-trivially destructible locals in scope
+	template<typename F>
+	void run(F&& f)
+	{
+		Scope scope(base, base + span + guard);
+		if (sigsetjmp(scope.env, 0))
+			throw std::runtime_error("Memory access out of bounds");
+		f();
+	}
+
+private:
+	u8* base;
+
+	// The innermost run() on this thread
+	struct Scope
+	{
+		sigjmp_buf env;
+		const u8* const beg;
+		const u8* const end;
+		Scope* const outer;
+		Scope(const u8* beg, const u8* end) : beg(beg), end(end), outer(active) { active = this; }
+		~Scope() { active = outer; }
+	};
+	static inline thread_local Scope* active = nullptr;
+	static inline struct sigaction previous{};
+
+	static void on_fault(const int sig, siginfo_t* const info, void* const context)
+	{
+		const Scope* const scope = active;
+		const auto addr = static_cast<const u8*>(info->si_addr);
+		if (scope && addr >= scope->beg && addr < scope->end)
+			siglongjmp(const_cast<Scope*>(scope)->env, 1);
+
+		// Not a guest access: pass it on, or let the faulting access rerun with the default action
+		if (previous.sa_flags & SA_SIGINFO)
+			previous.sa_sigaction(sig, info, context);
+		else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+			previous.sa_handler(sig);
+		else
+			signal(sig, SIG_DFL);
+	}
+
+	static void install_handler()
+	{
+		static const bool installed = [] {
+			struct sigaction action{};
+			action.sa_sigaction = &on_fault;
+			action.sa_flags = SA_SIGINFO | SA_NODEFER; // unwinding with siglongjmp leaves SIGSEGV unblocked
+			sigemptyset(&action.sa_mask);
+			return sigaction(SIGSEGV, &action, &previous) == 0;
+		}();
+		if (!installed)
+			throw std::runtime_error("Failed to install guarded memory fault handler");
+	}
+};
+#endif
+
+// Allocator for program and stack buffers: large ones are anonymous mappings (with TINYRISCV64_MMAP),
+//   whose pages take no memory until written, others are zeroed on the heap; an element is only
+//   written if it isn't already the value it's constructed with, so zero filling a buffer and
+//   copying zeros into it leave untouched pages untouched
+template<typename T>
+struct ZeroPageAllocator
+{
+	static_assert(std::is_trivially_copyable_v<T>, "ZeroPageAllocator compares and copies elements bytewise");
+	using value_type = T;
+	static constexpr size_t map_threshold = 64*1024; // Bytes
+
+	ZeroPageAllocator() = default;
+	template<typename U> ZeroPageAllocator(const ZeroPageAllocator<U>&) {}
+
+	// Whether an allocation of n elements is mapped (so page aligned, and can be mapped over)
+	static bool mapped(const size_t n)
+	{
+		#if defined(TINYRISCV64_MMAP)
+		return n * sizeof(T) >= map_threshold;
+		#else
+		return (void)n, false;
+		#endif
+	}
+
+	T* allocate(const size_t n)
+	{
+		#if defined(TINYRISCV64_MMAP)
+		if (mapped(n))
+		{
+			void* const mem = mmap(nullptr, n * sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (mem == MAP_FAILED)
+				throw std::bad_alloc();
+			return static_cast<T*>(mem);
+		}
+		#endif
+		void* const mem = std::calloc(n, sizeof(T));
+		if (!mem && n)
+			throw std::bad_alloc();
+		return static_cast<T*>(mem);
+	}
+
+	void deallocate(T* const p, const size_t n)
+	{
+		#if defined(TINYRISCV64_MMAP)
+		if (mapped(n))
+		{
+			munmap(p, n * sizeof(T));
+			return;
+		}
+		#endif
+		std::free(p);
+	}
+
+	template<typename U, typename... Args>
+	void construct(U* const p, Args&&... args)
+	{
+		const U value(std::forward<Args>(args)...);
+		if (std::memcmp(p, &value, sizeof(U)))
+			std::memcpy(p, &value, sizeof(U));
+	}
+
+	template<typename U> bool operator==(const ZeroPageAllocator<U>&) const { return true; }
+};
+
+// Program and stack memory
+using Bytes = std::vector<u8, ZeroPageAllocator<u8>>;
+
+// A file mapped private and writable: pages are read as they are touched, and writes stay in memory
+//   (copy-on-write) so the file never changes; without TINYRISCV64_MMAP the file is read in whole
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& filename)
+	{
+		#if defined(TINYRISCV64_MMAP)
+		fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::invalid_argument(std::format("Failed to open file: {}", filename));
+		struct stat st{};
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void* const mem = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (mem != MAP_FAILED)
+			{
+				base = static_cast<u8*>(mem);
+				length = st.st_size;
+			}
+		}
+		if (!base)
+		{
+			close(fd);
+			throw std::runtime_error(std::format("Failed to map file: {}", filename));
+		}
+		#else
+		std::ifstream fin(filename, std::ios::binary | std::ios::ate);
+		if (!fin)
+			throw std::invalid_argument(std::format("Failed to open file: {}", filename));
+		bytes.resize(fin.tellg());
+		fin.seekg(0, std::ios::beg);
+		fin.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+		base = bytes.data();
+		length = bytes.size();
+		#endif
+	}
+	~MappedFile()
+	{
+		#if defined(TINYRISCV64_MMAP)
+		munmap(base, length);
+		close(fd);
+		#endif
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	u8* data() const { return base; }
+	size_t size() const { return length; }
+
+	// Put the file's [offset, offset+size) at dst, mapping it copy-on-write over the whole host pages
+	//   it lines up with, and copying the rest; dst must lie in a mapped ZeroPageAllocator allocation
+	void map_to(u8* const dst, const u64 offset, const size_t size) const
+	{
+		if (offset > length || size > length - offset)
+			throw std::out_of_range("Mapped range extends beyond end of file");
+		size_t head = size, tail = size;
+		#if defined(TINYRISCV64_MMAP)
+		static const uintptr_t host_page = sysconf(_SC_PAGESIZE);
+		const uintptr_t beg = reinterpret_cast<uintptr_t>(dst);
+		const uintptr_t page_beg = (beg + host_page - 1) & ~(host_page - 1);
+		const uintptr_t page_end = (beg + size) & ~(host_page - 1);
+		if ((offset + (page_beg - beg)) % host_page == 0 && page_beg < page_end
+			&& mmap(reinterpret_cast<void*>(page_beg), page_end - page_beg, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_FIXED, fd, offset + (page_beg - beg)) != MAP_FAILED)
+		{
+			head = page_beg - beg;
+			tail = beg + size - page_end;
+		}
+		#endif
+		std::memcpy(dst, base + offset, head);
+		if (tail != size)
+			std::memcpy(dst + size - tail, base + offset + size - tail, tail);
+	}
+
+private:
+	u8* base = nullptr;
+	size_t length = 0;
+	#if defined(TINYRISCV64_MMAP)
+	int fd = -1;
+	#else
+	std::vector<u8> bytes;
+	#endif
+};
+
 class VM
 {
+public:
+	class Image;
+
 protected:
 	u64 pc;                         // Program counter
 	u32 inst;                       // Current instruction
-	std::vector<u8> program;        // Program memory
+	Bytes program;                  // Program memory (from shared_end)
+	std::shared_ptr<const Image> image; // Shared program image (see program_attach()), or nullptr
+	std::shared_ptr<const VerifiedCode> verified = std::make_shared<const VerifiedCode>(); // What loading the program verified (never null)
+	u64 shared_end = 0;             // End of the shared read-only part of the image, where program starts (p_beg if not shared)
 	std::array<u64,32> x{};         // Registers x0-x31
-	std::vector<u8> stack;          // Stack memory
-	std::span<u8> data;             // Data memory
+	Bytes stack;                    // Stack memory
+	struct DataRegion
+	{
+		std::span<u8> mem;          // Host buffer
+		size_t capacity;            // Size laid out by map_data_mem() (see rebind_data_mem())
+		bool read_only;
+		u64 beg, end;               // Virtual bounds
+	};
+	std::vector<DataRegion> data_regions{1}; // Data memory, in address order (at least one, maybe empty)
+	bool data_single = true;        // One writable data region: accesses skip the region search
 	std::atomic_bool halted{false}; // Program exited or externally halted
+	bool fuel_out = false;          // The last run ran out of instructions (halted isn't set)
+	bool in_run = false;            // Running from run(), where the guest can yield
+	bool yielded = false;           // The guest yielded, and halted is set until run() continues
+	std::string trap;               // Why the last run() trapped
+	size_t retired = 0;             // Instructions the last run retired
 	const size_t max_prog_size;     // Maximum allowed program image size (bytes)
+	Engine engine;                  // Selected execution engine
+	Memory memory = Memory::Regions; // Selected memory backing
+	Memory mem_path = Memory::Regions; // How mem_ptr() resolves addresses (host code accesses Memory::Guarded via Regions)
+	Bytes flat;                     // Memory::Flat arena [0, s_end): unused below p_beg, program, (gaps and data regions, unused), stack
+#if defined(TINYRISCV64_GUARD)
+	std::unique_ptr<GuardedArena> guarded; // Memory::Guarded arena, laid out like flat
+	std::vector<u64> guarded_layout; // s_end and data regions the guarded arena was laid out for
+#endif
+	std::unique_ptr<PageTable> pages; // Memory::Paged page table
+	std::vector<std::array<u64,2>> paged_regions; // Program, stack and data region ranges mapped in pages
+	bool program_stale = false;     // The program was reloaded since the arena was laid out
+	bool paged_stale = false;       // Memory::Paged pages hold the program and stack, not their (empty) buffers (see fork())
+	std::array<size_t,2> paged_sizes{}; // Program and stack sizes while paged_stale
+	u8* arena_mem = nullptr;        // Memory::Flat/Guarded arena, or nullptr
+	u8* prog_mem = nullptr;         // Program memory as accessed (program, or its copy in the arena), virtual shared_end
+	const u8* shared_mem = nullptr; // Shared image part as accessed (the image, or its copy in the arena), virtual p_beg
+	u8* stack_mem = nullptr;        // Stack memory as accessed (stack, or its copy in the arena)
+
+	enum class Op : u8
+	{
+		#define TINYRISCV64_OP_ENUM(name) name,
+		TINYRISCV64_OPS(TINYRISCV64_OP_ENUM)
+		#undef TINYRISCV64_OP_ENUM
+	};
+
+	// One pre-decoded instruction; four fit in a 64 byte cache line
+	struct DecodedOp
+	{
+		Op op;        // Operation (handler id)
+		u8 rd;        // Destination register
+		u8 rs1;       // Source register 1
+		u8 rs2;       // Source register 2
+		u32 inst;     // Raw instruction word (used by INTERP)
+		i64 imm;      // Sign-extended immediate, shift amount, or absolute target/value
+	};
+	static_assert(sizeof(DecodedOp) == 16, "DecodedOp must be 16 bytes");
+
+	// The ops a fused op runs in sequence
+	//   a fused op keeps the fields of its first op; the others are read from the following slots
+	struct FusedParts
+	{
+		u8 width;     // Instructions covered
+		Op part[3];   // Ops run, in order
+	};
+	static constexpr FusedParts fused_parts(const Op op)
+	{
+		switch(op)
+		{
+			case Op::LI_ADDI:       return {2, {Op::LI, Op::ADDI}};     // LUI/AUIPC + ADDI constant or address
+			case Op::LI_ADDIW:      return {2, {Op::LI, Op::ADDIW}};    // LUI + ADDIW constant
+			case Op::LI_JALR:       return {2, {Op::LI, Op::JALR}};     // AUIPC + JALR far call
+			case Op::SLLI_SRLI:     return {2, {Op::SLLI, Op::SRLI}};   // zero-extension, bitfield extract
+			case Op::SRLI_SLLI:     return {2, {Op::SRLI, Op::SLLI}};
+			case Op::ADDI_BNE:      return {2, {Op::ADDI, Op::BNE}};    // loop counter
+			case Op::SLLI_SRLI_OR:  return {3, {Op::SLLI, Op::SRLI, Op::OR}}; // rotate
+			case Op::SLLI_SRLI_ADD: return {3, {Op::SLLI, Op::SRLI, Op::ADD}};
+			case Op::SLLI_SRLI_XOR: return {3, {Op::SLLI, Op::SRLI, Op::XOR}};
+			case Op::SRLI_SLLI_OR:  return {3, {Op::SRLI, Op::SLLI, Op::OR}};
+			case Op::SRLI_SLLI_ADD: return {3, {Op::SRLI, Op::SLLI, Op::ADD}};
+			case Op::SRLI_SLLI_XOR: return {3, {Op::SRLI, Op::SLLI, Op::XOR}};
+			default:                return {1, {op}};
+		}
+	}
+	static constexpr bool is_fused(const Op op) { return op >= Op::LI_ADDI; }
+	static constexpr u8 op_width(const Op op) { return fused_parts(op).width; }
+	static constexpr Op base_op(const Op op) { return fused_parts(op).part[0]; }
+
+	// Per-run limits and progress shared by the decoded-op engines
+	struct RunLimits
+	{
+		u64 first_pc;     // First pc of the program (p_beg)
+		u64 pc_span;      // Last pc a whole instruction can be fetched from, less first_pc
+		u64 sentinel_pc;  // Return address that ends the program
+		size_t count;     // Instructions executed so far
+		size_t max;       // Instruction budget
+
+		// Whether an instruction can't be fetched from pc, one compare for both bounds
+		bool outside(const u64 pc) const { return pc - first_pc > pc_span; }
+	};
+
+	// State shared with JIT compiled blocks (Engine::JIT)
+	struct JitContext
+	{
+		u64* x;                      // Guest registers
+		u64 p_beg, p_end, p_host;    // Program region bounds (writable part), host address of virtual 0
+		u64 r_beg, r_end, r_host;    // Shared image part bounds (loads only), host address of virtual 0
+		u64 d_beg, d_end, d_host;    // Data region bounds, host address of virtual 0
+		u64 s_beg, s_end, s_host;    // Stack region bounds, host address of virtual 0
+		u64 tlb;                     // Memory::Paged TLB (see PageTable::TlbEntry)
+		VM* vm;                      // Owner, for calls back into the VM
+		u64 pc;                      // Next pc, set on return
+	};
+	// A compiled block returns how many of its ops ran, with jit_interp set if the next op must be interpreted
+	using JitFn = u64(*)(JitContext*);
+	static constexpr u64 jit_interp = 1ULL << 63;
+	static constexpr u32 jit_threshold = 16; // Executions before a block is compiled
+
+	// A basic block of decoded ops, ending at a control transfer or INTERP op
+	struct Block
+	{
+		u32 first;        // Index of the first op in decoded
+		u32 len;          // Number of ops, including the terminator
+		u64 succ_pc[2];   // Successor addresses (fall-through, target) - a JALR caches its last target
+		u32 succ[2];      // Chained successor block indexes (no_block until first taken)
+		bool indirect;    // Ends in JALR
+		u32 hits;         // Executions so far, up to jit_threshold (Engine::JIT)
+		JitFn code;       // Compiled block, or nullptr
+	};
+	static constexpr u32 no_block = ~0u;
+
+public:
+	// A loaded program that any number of VMs can attach to (see program_attach())
+	//   the bytes below ro_end and their decoded ops are shared read-only; each VM copies the
+	//   rest (.data, .bss, heap) for itself
+	class Image
+	{
+	public:
+		// The image is loaded at virtual base; a read-only part short of the whole image ends on a page,
+		//   so Memory::Paged can map it on its own
+		//   its code (the shared part, or all of it if none is) is verified once, for every VM attached (see
+		//   verify_code()), and throws std::invalid_argument if it's bad
+		Image(Bytes image, const u64 base, const u64 read_only_end, const u64 entry_point, const u64 tls = 0,
+			std::shared_ptr<const Symbols> symbol_table = std::make_shared<const Symbols>(), const std::span<const u64> roots = {})
+			: bytes(std::move(image)), base(base),
+			  ro_end(read_only_end >= base + bytes.size() ? base + bytes.size()
+				: std::max(base, read_only_end & ~PageTable::page_mask)),
+			  entry(entry_point), tls_tp(tls), symbols(std::move(symbol_table)),
+			  code(verify_code({bytes.data(), ro_end != base ? ro_end - base : bytes.size()}, base,
+				(base + bytes.size() + 3) & ~3ull, entry, *symbols, roots))
+		{
+			decoded.resize((ro_end - base) / 4);
+			for (size_t i = 0; i < decoded.size(); ++i)
+			{
+				u32 word;
+				std::memcpy(&word, bytes.data() + i*4, 4);
+				decoded[i] = decode_in_code(word, base + i*4, base, ro_end, (base + bytes.size() + 3) & ~3ull);
+			}
+			fuse_decoded(decoded);
+		}
+		Image(const Image&) = delete;
+		Image& operator=(const Image&) = delete;
+
+		const Bytes bytes;           // Program memory from virtual base
+		const u64 base;              // Where the program starts (see VM::p_beg)
+		const u64 ro_end;            // End of the shared read-only part (base if none)
+		const u64 entry;             // Entry point
+		const u64 tls_tp;            // Thread pointer (see ElfVM)
+		const std::shared_ptr<const Symbols> symbols; // Never null (see ElfVM::symbols())
+		const std::shared_ptr<const VerifiedCode> code; // Never null (see VM::verified_code())
+
+	private:
+		friend class VM;
+		std::vector<DecodedOp> decoded; // Never written: stores below ro_end are refused
+	};
+
+protected:
+	std::span<DecodedOp> decoded;   // Decoded program, indexed by pc/4 (all engines but Interpreter)
+	std::vector<DecodedOp> decoded_own; // decoded, unless it is a shared image's (see Image)
+	u64 decoded_end = 0;            // End of the decoded address range (0 if not decoded)
+	std::vector<Block> blocks;      // Translated basic blocks (Engine::Block)
+	std::vector<u32> block_at;      // Block index starting at each decoded op, or no_block
+	u64 blocks_lo = 0, blocks_hi = 0; // Decoded op index range covered by blocks
+	bool blocks_stale = false;      // Program memory under a block was written
+	u32 block_running = no_block;   // Block that exec_block() is running, for the count if it faults
+	DecodedOp unfused;              // First op of a fused op that didn't fit the instruction budget
+#if defined(TINYRISCV64_JIT)
+	std::unique_ptr<X64Emitter> jit; // Code cache for compiled blocks (Engine::JIT)
+#endif
+
+	// Virtual addressing:
+	u64 p_beg = 0;   // Program mem begin (where the program was linked to start; nothing below it is backed)
+	u64 p_end;       // Program mem end
+							/* 64 overflow detection addresses */
+	u64 d_beg;       // Data mem begin
+	u64 d_end;       // Data mem end
+							/* 64 overflow detection addresses */
+	u64 s_beg;       // Stack mem begin
+	u64 s_end;       // Stack mem end
+
+public:
+	// An entry point that stands for wherever the program starts (p_beg)
+	static constexpr u64 base_entry = ~0ull;
+
+	VM(const size_t stack_size = 4096, const size_t max_program_size = 1024UL*1024, const Engine engine = Engine::Interpreter)
+		: stack(stack_size), max_prog_size(max_program_size), engine(engine) { reset(); }
+	virtual ~VM() = default; // Owned as a VM by fork() and the Scheduler
+
+	// Load program from file and return the virtual start addr
+	//   the code is verified from there first (see verified_code()), throwing std::invalid_argument if it's bad
+	//   resets state and invalidates previous virtual addrs
+	virtual u64 program_load(const std::string& prog_filename)
+	{
+		auto prog = load_program(prog_filename, max_prog_size);
+		verified = verify_code(prog, 0, (prog.size() + 3) & ~3ull, 0);
+		program = std::move(prog);
+		image.reset();
+		p_beg = shared_end = 0;
+		program_changed();
+		reset();
+		return p_beg;
+	}
+
+	// Copy bytecode, to run at virtual base (where it was linked to start), and return the starting virtual addr
+	//   only [base, base+prog_size) is backed, so max_program_size applies to prog_size alone
+	//   the code is verified from base first (see verified_code()), throwing std::invalid_argument if it's bad
+	//   resets state and invalidates previous virtual addrs
+	u64 program_load(const u8* const prog, size_t prog_size, const u64 base = 0)
+	{
+		if (prog_size > max_prog_size)
+			throw std::invalid_argument(std::format("Program too large (max {} bytes)", max_prog_size));
+		if (base & 3 || base > (1ULL << 47))
+			throw std::invalid_argument(std::format("Invalid program base 0x{:x}", base));
+		verified = verify_code({prog, prog_size}, base, (base + prog_size + 3) & ~3ull, base);
+		program.resize(prog_size);
+		std::memcpy(program.data(), prog, prog_size);
+		image.reset();
+		p_beg = shared_end = base;
+		program_changed();
+		reset();
+		return p_beg;
+	}
+
+	// A copy of this VM, to run from its current state: registers, pc, memory, engine and backing
+	//   with Memory::Paged the program and stack pages are shared copy-on-write with this VM,
+	//   otherwise they are copied; a shared program image stays shared, and data buffers stay mapped
+	//   in both (map others to keep them apart)
+	virtual std::unique_ptr<VM> fork()
+	{
+		auto child = std::make_unique<VM>(stack_bytes(), max_prog_size, engine);
+		fork_into(*child);
+		return child;
+	}
+
+	// Save the VM state to a file, to continue from later (see snapshot_load()): registers, pc,
+	//   memory backing and layout, the program image, where its code was verified from, and the stack and
+	//   data region contents
+	void snapshot_save(const std::string& filename) const
+	{
+		SnapshotHeader h{};
+		std::memcpy(h.magic, snapshot_magic, sizeof h.magic);
+		h.version = snapshot_version;
+		h.header_size = sizeof h;
+		h.pc = pc;
+		h.x = x;
+		h.x[0] = 0;
+		h.memory = static_cast<u64>(memory);
+		h.shared_end = shared_end;
+		h.p_beg = p_beg;
+		h.p_end = p_end;
+		h.s_beg = s_beg;
+		h.s_end = s_end;
+		h.region_count = data_regions.size();
+		const auto extra = snapshot_extra();
+		h.extra_count = extra.size();
+		h.root_count = verified->roots.size();
+
+		// Sections start on page boundaries, so that a mapped file lines them up with guest pages
+		const auto page_up = [](const u64 n) { return (n + PageTable::page_size - 1) & ~(PageTable::page_size - 1); };
+		std::vector<std::array<u64,5>> regions; // {beg, capacity, size, read_only, offset}
+		u64 off = page_up(sizeof h);
+		h.program_off = off;
+		off = h.stack_off = page_up(off + p_end - p_beg);
+		off = h.regions_off = page_up(off + s_end - s_beg);
+		off = h.extra_off = off + data_regions.size() * sizeof(regions[0]);
+		off = h.roots_off = off + extra.size() * sizeof(u64);
+		off = page_up(off + verified->roots.size() * sizeof(u64));
+		for (const auto& region : data_regions)
+		{
+			regions.push_back({region.beg, region.capacity, region.mem.size(), region.read_only, off});
+			off = page_up(off + region.mem.size());
+		}
+		h.file_size = off;
+
+		std::vector<u8> prog(p_end - p_beg), stack_copy(s_end - s_beg);
+		if (pages)
+		{
+			pages->peek(p_beg, prog.data(), prog.size());
+			pages->peek(s_beg, stack_copy.data(), stack_copy.size());
+		}
+		else
+		{
+			if (arena_mem)
+				std::memcpy(prog.data(), arena_mem + p_beg, prog.size());
+			else
+				copy_program(prog.data());
+			std::memcpy(stack_copy.data(), stack_mem, stack_copy.size());
+		}
+
+		std::ofstream fout(filename, std::ios::binary | std::ios::trunc);
+		if (!fout)
+			throw std::invalid_argument(std::format("Failed to create snapshot file: {}", filename));
+		const auto put = [&fout](const u64 at, const void* const bytes, const size_t size) {
+			static const std::array<char, PageTable::page_size> zeros{};
+			for (u64 pos = fout.tellp(); pos < at; pos = fout.tellp())
+				fout.write(zeros.data(), std::min<u64>(at - pos, zeros.size()));
+			fout.write(static_cast<const char*>(bytes), size);
+		};
+		put(0, &h, sizeof h);
+		put(h.program_off, prog.data(), prog.size());
+		put(h.stack_off, stack_copy.data(), stack_copy.size());
+		put(h.regions_off, regions.data(), regions.size() * sizeof(regions[0]));
+		put(h.extra_off, extra.data(), extra.size() * sizeof(u64));
+		put(h.roots_off, verified->roots.data(), verified->roots.size() * sizeof(u64));
+		for (size_t i = 0; i < regions.size(); ++i)
+			put(regions[i][4], data_regions[i].mem.data(), data_regions[i].mem.size());
+		put(h.file_size, nullptr, 0);
+		if (!fout.flush())
+			throw std::runtime_error(std::format("Failed to write snapshot file: {}", filename));
+	}
+
+	// Restore the state saved by snapshot_save(), memory backing included
+	//   the data buffers must be mapped already, matching the saved regions in number, size and access,
+	//   and get the saved contents (read-only ones are left alone); with Memory::Paged the file is mapped
+	//   copy-on-write so that only the pages touched are read, and VMs restored from one file share them
+	//   the program's code is verified again, from where it was verified when loaded and from the saved pc
+	//   run() continues from the saved pc; a snapshot that doesn't fit this VM throws, leaving it to be reset or loaded again
+	//   invalidates previous virtual addrs
+	void snapshot_load(const std::string& filename)
+	{
+		auto file = std::make_shared<MappedFile>(filename);
+		SnapshotHeader h;
+		if (file->size() < sizeof h || std::memcmp(file->data(), snapshot_magic, sizeof h.magic))
+			throw std::invalid_argument(std::format("Not a snapshot file: {}", filename));
+		std::memcpy(&h, file->data(), sizeof h);
+		if (h.version != snapshot_version || h.header_size != sizeof h)
+			throw std::invalid_argument(std::format("Unsupported snapshot version {}", h.version));
+		const auto section = [&file](const u64 off, const u64 size) {
+			if (off > file->size() || size > file->size() - off)
+				throw std::runtime_error("Truncated snapshot file");
+			return file->data() + off;
+		};
+		if (h.file_size != file->size() || h.p_end < h.shared_end || h.shared_end < h.p_beg || h.s_end < h.s_beg
+			|| h.memory > static_cast<u64>(Memory::Paged))
+			throw std::runtime_error("Corrupt snapshot file");
+		if (h.p_end - h.p_beg > max_prog_size)
+			throw std::invalid_argument(std::format("Program too large (max {} bytes)", max_prog_size));
+		u8* const prog = section(h.program_off, h.p_end - h.p_beg);
+		u8* const stack_src = section(h.stack_off, h.s_end - h.s_beg);
+		if (h.region_count > file->size() / sizeof(std::array<u64,5>))
+			throw std::runtime_error("Truncated snapshot file");
+		std::vector<std::array<u64,5>> regions(h.region_count);
+		std::memcpy(regions.data(), section(h.regions_off, regions.size() * sizeof(regions[0])), regions.size() * sizeof(regions[0]));
+		bool match = regions.size() == data_regions.size();
+		for (size_t i = 0; match && i < regions.size(); ++i)
+			match = regions[i][1] == data_regions[i].capacity && regions[i][2] == data_regions[i].mem.size()
+				&& regions[i][3] == data_regions[i].read_only;
+		if (!match)
+			throw std::invalid_argument("Snapshot data regions don't match the mapped ones");
+		for (const auto& region : regions)
+			section(region[4], region[2]);
+		if (h.extra_count > file->size() / sizeof(u64))
+			throw std::runtime_error("Truncated snapshot file");
+		std::vector<u64> extra(h.extra_count);
+		std::memcpy(extra.data(), section(h.extra_off, extra.size() * sizeof(u64)), extra.size() * sizeof(u64));
+		if (h.root_count > file->size() / sizeof(u64))
+			throw std::runtime_error("Truncated snapshot file");
+		std::vector<u64> roots(h.root_count);
+		std::memcpy(roots.data(), section(h.roots_off, roots.size() * sizeof(u64)), roots.size() * sizeof(u64));
+
+		// The code as if it were loaded (or attached, with the image it was shared from), running from pc too
+		const u64 shared_size = h.shared_end - h.p_beg;
+		const u64 code_end = shared_size ? h.shared_end : h.p_end;
+		if (in_code(h.pc, h.p_beg, code_end))
+			roots.push_back(h.pc);
+		auto restored_image = shared_size ? std::make_shared<const Image>(Bytes(prog, prog + (h.p_end - h.p_beg)),
+			h.p_beg, h.shared_end, base_entry, 0, std::make_shared<const Symbols>(), roots) : nullptr;
+		auto restored_code = restored_image ? restored_image->code
+			: verify_code({prog, h.p_end - h.p_beg}, h.p_beg, (h.p_end + 3) & ~3ull, base_entry, Symbols(), roots);
+		snapshot_restore_extra(extra);
+
+		// Drop the current backing: the program and stack come from the snapshot
+		flat = {};
+		#if defined(TINYRISCV64_GUARD)
+		guarded.reset();
+		#endif
+		arena_mem = nullptr;
+		pages.reset();
+		paged_regions.clear();
+		paged_stale = false;
+		program_stale = false;
+		memory = mem_path = static_cast<Memory>(h.memory);
+		p_beg = h.p_beg;
+		shared_end = h.shared_end;
+		image = std::move(restored_image);
+		verified = std::move(restored_code);
+		shared_mem = image ? image->bytes.data() : nullptr;
+		if (memory == Memory::Paged) // the file's pages back the program and stack until written
+		{
+			pages = std::make_unique<PageTable>();
+			program = {};
+			stack = {};
+			paged_sizes = {h.p_end - shared_end, h.s_end - h.s_beg};
+			paged_stale = true;
+			if (shared_size)
+				pages->map(p_beg, const_cast<u8*>(image->bytes.data()), shared_size, Perm::RX);
+			pages->map(shared_end, prog + shared_size, paged_sizes[0], shared_size ? Perm::RW : Perm::RWX);
+			pages->map(h.s_beg, stack_src, paged_sizes[1], Perm::RW);
+			pages->adopt(shared_end, paged_sizes[0], file);
+			pages->adopt(h.s_beg, paged_sizes[1], file);
+			paged_regions = {{p_beg, h.p_end}, {h.s_beg, h.s_end}};
+		}
+		else
+		{
+			program.assign(prog + shared_size, prog + (h.p_end - p_beg));
+			stack.assign(stack_src, stack_src + (h.s_end - h.s_beg));
+		}
+		prog_mem = program.data();
+		predecode_program();
+		reset();
+
+		match = p_end == h.p_end && s_beg == h.s_beg && s_end == h.s_end;
+		for (size_t i = 0; match && i < regions.size(); ++i)
+			match = data_regions[i].beg == regions[i][0];
+		if (!match)
+			throw std::runtime_error("Snapshot layout doesn't match this VM");
+		for (size_t i = 0; i < regions.size(); ++i)
+			if (!data_regions[i].read_only)
+				std::memcpy(data_regions[i].mem.data(), file->data() + regions[i][4], regions[i][2]);
+		x = h.x;
+		pc = h.pc;
+		halted = false;
+		yielded = false;
+	}
+
+	// Load a program from file into an image that VMs can share (see program_attach())
+	//   raw bytecode doesn't say where its code ends, so only its first read_only_size bytes (down to a page,
+	//   unless that's all of it) are shared read-only; by default none are, and each VM runs its own copy,
+	//   free to write its globals as if it were loaded
+	static std::shared_ptr<const Image> load_image(const std::string& prog_filename, const size_t max_program_size = 1024UL*1024,
+		const size_t read_only_size = 0)
+	{
+		auto prog = load_program(prog_filename, max_program_size);
+		return std::make_shared<const Image>(std::move(prog), 0, read_only_size, 0);
+	}
+
+	// Attach a shared program image and return its entry point, copying only its writable part
+	//   stores to the shared part fail, and only the shared part can be executed (with no shared
+	//   part, the VM runs its own copy of the whole image as if it were loaded)
+	//   resets state and invalidates previous virtual addrs
+	virtual u64 program_attach(std::shared_ptr<const Image> shared)
+	{
+		if (shared->bytes.size() > max_prog_size)
+			throw std::invalid_argument(std::format("Program too large (max {} bytes)", max_prog_size));
+		image = std::move(shared);
+		verified = image->code;
+		p_beg = image->base;
+		shared_end = image->ro_end;
+		program.assign(image->bytes.begin() + (shared_end - p_beg), image->bytes.end());
+		program_changed();
+		reset();
+		return image->entry;
+	}
+
+	// What verifying the loaded program found (see VerifiedCode)
+	const VerifiedCode& verified_code() const { return *verified; }
+
+	// Select the execution engine
+	//   the loaded program is (re)decoded if the engine needs it
+	void set_engine(const Engine new_engine)
+	{
+		engine = new_engine;
+		predecode_program();
+	}
+
+	Engine get_engine() const { return engine; }
+
+	// Select the memory backing
+	//   with Memory::Flat or Guarded the program and stack live in the arena, while the
+	//   data regions are accessed in their own buffers
+	//   Memory::Guarded and Paged page align the regions, so switching to or from them resets state
+	//   and invalidates previous virtual addrs
+	void set_memory(const Memory new_memory)
+	{
+		if (new_memory == memory)
+			return;
+		sync_buffers();
+		if (arena_mem)
+		{
+			flat.clear();
+			flat.shrink_to_fit();
+			#if defined(TINYRISCV64_GUARD)
+			guarded.reset();
+			#endif
+			arena_mem = nullptr;
+		}
+		pages.reset();
+		paged_regions.clear();
+		const auto page_aligned = [](const Memory m) { return m == Memory::Guarded || m == Memory::Paged; };
+		const bool relayout = page_aligned(memory) || page_aligned(new_memory);
+		memory = new_memory;
+		flush_blocks(); // compiled blocks depend on the backing
+		if (relayout)
+			reset();
+		else
+			map_memory();
+	}
+
+	Memory get_memory() const { return memory; }
+
+	// Map virtual addresses to the referenced data
+	//   resets state and invalidates previous virtual addrs
+	u64 map_data_mem(u8* const mem, const size_t mem_size)
+	{
+		return map_data_mem(std::array{DataBuffer{{mem,mem_size}}})[0];
+	}
+
+	// Map several buffers as data regions, one after another with overflow gaps between them,
+	//   and return their virtual addrs; stores to read-only regions fail
+	//   resets state and invalidates previous virtual addrs
+	std::vector<u64> map_data_mem(std::span<const DataBuffer> buffers)
+	{
+		std::vector<DataRegion> regions;
+		for (const auto& buffer : buffers)
+			regions.push_back({buffer.mem, buffer.mem.size(), buffer.read_only, 0, 0});
+		if (regions.empty())
+			regions.resize(1);
+		data_regions = std::move(regions);
+		data_single = data_regions.size() == 1 && !data_regions[0].read_only;
+		reset();
+		std::vector<u64> addrs;
+		for (const auto& region : data_regions)
+			addrs.push_back(region.beg);
+		return addrs;
+	}
+
+	// Point a data region at another buffer, no larger than the one given to map_data_mem()
+	//   keeps registers, stack and program memory, and returns the same virtual addr
+	u64 rebind_data_mem(u8* const mem, const size_t mem_size, const size_t index = 0)
+	{
+		if (index >= data_regions.size())
+			throw std::invalid_argument(std::format("No data region {} to rebind", index));
+		auto& region = data_regions[index];
+		if (mem_size > region.capacity)
+			throw std::invalid_argument(std::format("Data buffer too large to rebind (max {} bytes)", region.capacity));
+		if (pages && paged_regions.size() > 2 + index) // laid out (not just a reloaded program)
+		{
+			pages->unmap(region.beg, region.end - region.beg);
+			pages->map(region.beg, mem, mem_size, region.read_only ? Perm::R : Perm::RW);
+			paged_regions[2 + index] = {region.beg, region.beg+mem_size};
+		}
+		region.mem = {mem,mem_size};
+		region.end = region.beg+mem_size;
+		d_end = data_regions.back().end;
+		return region.beg;
+	}
+
+	// Map host memory at a guest address (Memory::Paged)
+	//   mem must stay valid while mapped; the pages can't overlap the regions or other mappings
+	void map_pages(const u64 vaddr, std::span<u8> mem, const Perm perm = Perm::RW)
+	{
+		page_table().map(vaddr, mem.data(), mem.size(), perm);
+	}
+
+	// Map zero-filled memory at a guest address, allocated a page at a time as it is first touched (Memory::Paged)
+	void map_zero_pages(const u64 vaddr, const u64 size, const Perm perm = Perm::RW)
+	{
+		page_table().map(vaddr, nullptr, size, perm);
+	}
+
+	// Unmap every page overlapping [vaddr, vaddr+size) (Memory::Paged)
+	//   unmapped program, data or stack pages stay unmapped until the next reset()
+	void unmap_pages(const u64 vaddr, const u64 size)
+	{
+		if (vaddr < shared_end && vaddr + size > p_beg)
+			throw std::logic_error("The pages of a shared program image can't be remapped");
+		page_table().unmap(vaddr, size);
+		if (vaddr < decoded_end)
+			predecode_program();
+	}
+
+	// Change the permissions of every page overlapping [vaddr, vaddr+size) (Memory::Paged)
+	//   program pages without Perm::X fault when executed; reset() restores the regions' permissions
+	void protect_pages(const u64 vaddr, const u64 size, const Perm perm)
+	{
+		if (vaddr < shared_end && vaddr + size > p_beg)
+			throw std::logic_error("The pages of a shared program image can't be remapped");
+		page_table().protect(vaddr, size, perm);
+		if (vaddr < decoded_end)
+			predecode_program();
+	}
+
+	// Set register value (x0-x31, x0 is always 0)
+	void register_set(const size_t reg, const u64 value)
+	{
+		if (reg < 0 || reg >= 32)
+			throw std::invalid_argument("Invalid register number");
+		if (reg != 0) x[reg] = value;
+	}
+
+	// Get register value
+	u64 register_get(const size_t reg) const
+	{
+		if (reg < 0 || reg >= 32)
+			throw std::invalid_argument("Invalid register number");
+		return x[reg];
+	}
+
+	// Push a value onto the stack and return the virtual address (stack pointer)
+	template<typename T>
+	u64 stack_push(const T& val)
+	{
+		const HostAccess host(*this);
+		x[2] -= sizeof(T);
+		mem_store(x[2],val);
+		return x[2];
+	}
+
+	template<typename T>
+	T stack_pop()
+	{
+		const HostAccess host(*this);
+		x[2] += sizeof(T);
+		return mem_load<T>(x[2]-sizeof(T));
+	}
+
+	template<typename T>
+	T stack_peek()
+	{
+		const HostAccess host(*this);
+		return mem_load<T>(x[2]);
+	}
+
+	// Read or write guest memory at a virtual address (a global's, say), as the guest would
+	//   data regions are better accessed through their host buffers, which a run copies in and out of the arena
+	template<typename T>
+	T peek(const u64 addr)
+	{
+		const HostAccess host(*this);
+		return mem_load<T>(addr);
+	}
+
+	template<typename T>
+	void poke(const u64 addr, const T& val)
+	{
+		const HostAccess host(*this);
+		mem_store(addr, val);
+	}
+
+	// Execute program
+	void execute_program(const u64 entry_point = base_entry, const size_t max_instructions = 100000)
+	{
+		pc = entry_point == base_entry ? p_beg : entry_point;
+		halted = false;
+		yielded = false;
+		run_engine(max_instructions);
+		if (fuel_out)
+			throw std::runtime_error("Maximum instruction count exceeded");
+	}
+
+	// Set up run() to start the program at entry_point
+	void start_program(const u64 entry_point = base_entry)
+	{
+		pc = entry_point == base_entry ? p_beg : entry_point;
+		halted = false;
+		yielded = false;
+	}
+
+	// Run from pc for up to fuel instructions, and say why it stopped (see RunStatus)
+	//   running out of fuel, yielding or trapping keeps the guest's progress, so time slices of a
+	//   long run cost no unwinding: run() again to continue exactly where it stopped
+	RunStatus run(const size_t fuel)
+	{
+		if (yielded)
+		{
+			yielded = false;
+			halted = false;
+		}
+		if (halted)
+			return RunStatus::Halted;
+		in_run = true;
+		try
+		{
+			run_engine(fuel);
+		}
+		catch (const std::exception& e)
+		{
+			in_run = false;
+			trap = e.what();
+			return RunStatus::Trap;
+		}
+		in_run = false;
+		if (fuel_out)
+			return RunStatus::FuelExhausted;
+		return yielded ? RunStatus::Yield : RunStatus::Halted;
+	}
+
+	// Why the last run() returned RunStatus::Trap
+	const std::string& trap_reason() const { return trap; }
+
+	// Instructions retired by the last run() or execute_program() (a faulting one included)
+	size_t retired_count() const { return retired; }
+
+	// Halt the program (if it's running)
+	//   This is the only thread safe call - everything else should be called synchronously
+	bool halt_program()
+	{
+		auto alreadyHalted = halted.exchange(true);
+		return !alreadyHalted;
+	}
+
+	virtual void reset()
+	{
+		const u64 old_s_beg = s_beg;
+		p_end = shared_end + program_bytes();
+		if (memory == Memory::Guarded || memory == Memory::Paged)
+		{
+			// Whole unmapped pages instead of the 64 byte gaps, with each data region ending and the
+			//   stack starting on a page boundary so that overflowing any of them faults straight away
+			u64 page = PageTable::page_size;
+			#if defined(TINYRISCV64_GUARD)
+			if (memory == Memory::Guarded)
+				page = GuardedArena::page();
+			#endif
+			const auto page_up = [page](const u64 n) { return (n + page - 1) & ~(page - 1); };
+			u64 top = page_up(p_end);
+			for (auto& region : data_regions)
+			{
+				top += page+page_up(region.capacity);
+				region.beg = top-region.capacity;
+				region.end = region.beg+region.mem.size();
+			}
+			s_beg = top+page;
+		}
+		else
+		{
+			u64 addr = p_end;
+			for (auto& region : data_regions)
+			{
+				/* 64 overflow detection addresses */
+				region.beg = addr+64;
+				region.end = region.beg+region.mem.size();
+				addr = region.beg+region.capacity;
+			}
+			/* 64 overflow detection addresses */
+			s_beg = addr+64;
+		}
+		d_beg = data_regions.front().beg;
+		d_end = data_regions.back().end;
+		s_end = s_beg+stack_bytes();
+
+		reset_registers();
+
+		map_memory(old_s_beg);
+	}
+
+	// Call the function at entry_point once for each input buffer, back to back, passing its arguments
+	//   as args describes, and return what each call returned
+	//   the inputs are rebound in turn to one data region laid out for the largest (see rebind_data_mem()),
+	//   so there's one reset for the batch and decoded code carries over; each call starts with fresh
+	//   registers, while the stack and program memory are left as the last call left them
+	//   resets state and invalidates previous virtual addrs
+	std::vector<BatchResult> execute_batch(std::span<const std::span<u8>> inputs, std::span<const BatchArg> args,
+		const u64 entry_point = base_entry, const size_t max_instructions = 100000)
+	{
+		if (args.size() > 8)
+			throw std::invalid_argument(std::format("Too many batch arguments ({}, max 8)", args.size()));
+		std::vector<BatchResult> results;
+		if (inputs.empty())
+			return results;
+		results.reserve(inputs.size());
+		const auto largest = std::max_element(inputs.begin(), inputs.end(),
+			[](const auto& a, const auto& b) { return a.size() < b.size(); });
+		map_data_mem(largest->data(), largest->size());
+
+		const size_t outs = std::count(args.begin(), args.end(), BatchArg::Out);
+		for (const auto& input : inputs)
+		{
+			const u64 data = rebind_data_mem(input.data(), input.size());
+			reset_registers();
+			// Zeroed result slots on the stack, keeping sp 16 byte aligned
+			x[2] -= (outs * 8 + 15) & ~15ull;
+			{
+				const HostAccess host(*this);
+				for (size_t i = 0; i < outs; ++i)
+					mem_store<u64>(x[2] + i*8, 0);
+			}
+			for (size_t i = 0, out = 0; i < args.size(); ++i)
+			{
+				switch (args[i])
+				{
+					case BatchArg::Data: x[10+i] = data; break;
+					case BatchArg::Size: x[10+i] = input.size(); break;
+					case BatchArg::Out:  x[10+i] = x[2] + 8*out++; break;
+				}
+			}
+			const u64 slots = x[2];
+
+			execute_program(entry_point, max_instructions);
+
+			BatchResult result{x[10], {}};
+			const HostAccess host(*this);
+			for (size_t i = 0; i < outs; ++i)
+				result.outs[i] = mem_load<u64>(slots + i*8);
+			results.push_back(result);
+		}
+		return results;
+	}
+
+	// Call the guest function at target with args, passed per the LP64 ABI, and return its a0 as R
+	//   integers and enums go in a0-a7 then on the stack; a span's bytes are copied below the stack
+	//   pointer and it's passed as their address, with a non-const span's copied back afterwards
+	//   nothing is reset: the function runs on the current stack and globals, and returns to the
+	//   sentinel; the registers, pc and run state are restored afterwards (even if it throws)
+	template<typename R = u64, typename... Args>
+	R call(const CallTarget target, const Args&... args)
+	{
+		static_assert(std::is_void_v<R> || std::is_integral_v<R> || std::is_enum_v<R>, "call() returns an integer or enum, or void");
+		const auto saved_x = x;
+		const u64 saved_pc = pc;
+		const bool saved_halted = halted;
+		const bool saved_yielded = yielded;
+		const auto restore = [&]
+		{
+			x = saved_x;
+			pc = saved_pc;
+			halted = saved_halted;
+			yielded = saved_yielded;
+		};
+
+		std::vector<u64> words;
+		std::vector<std::pair<u64, std::span<u8>>> copy_back;
+		u64 sp = x[2] & ~15ull;
+		{
+			const HostAccess host(*this);
+			(words.push_back(call_arg(args, sp, copy_back)), ...);
+			// The ninth argument on is on the stack, at the stack pointer
+			if (words.size() > 8)
+			{
+				sp = call_alloc(sp, (words.size() - 8) * 8);
+				for (size_t i = 8; i < words.size(); ++i)
+					mem_store<u64>(sp + (i-8)*8, words[i]);
+			}
+		}
+		for (size_t i = 0; i < words.size() && i < 8; ++i)
+			x[10+i] = words[i];
+		x[1] = halt_pc();
+		x[2] = sp;
+
+		u64 result = 0;
+		try
+		{
+			execute_program(target.entry, target.max_instructions);
+			result = x[10];
+			const HostAccess host(*this);
+			for (const auto& [addr, bytes] : copy_back)
+				for (size_t i = 0; i < bytes.size(); ++i)
+					bytes[i] = mem_load<u8>(addr + i);
+		}
+		catch (...)
+		{
+			restore();
+			throw;
+		}
+		restore();
+		if constexpr (!std::is_void_v<R>)
+			return static_cast<R>(result);
+	}
+
+protected:
+	// Registers as a program starts: zero, but for the return address and the stack and frame pointers
+	virtual void reset_registers()
+	{
+		for(auto& xn : x) xn=0;
+		//x1 - return address (ra)
+		x[1] = halt_pc();
+		//x2 - stack pointer (sp)
+		x[2] = s_end;
+		//x8 - frame pointer (s0 / fp)
+		x[8] = x[2];
+	}
+
+	// (Re)build the memory backing for the current layout
+	//   the arena keeps its program and stack contents unless the program was reloaded
+	void map_memory(const u64 old_s_beg = 0)
+	{
+		mem_path = memory;
+		arena_mem = nullptr;
+		#if defined(TINYRISCV64_GUARD)
+		if (memory == Memory::Guarded)
+		{
+			std::vector<u64> layout{s_end};
+			for (const auto& region : data_regions)
+				layout.insert(layout.end(), {region.beg, region.capacity, region.read_only});
+			if (!guarded || guarded_layout != layout || program_stale)
+			{
+				if (s_end > GuardedArena::span)
+					throw std::invalid_argument(std::format("Guarded memory layout too large ({} bytes, max {})", s_end, GuardedArena::span));
+				auto arena = std::make_unique<GuardedArena>();
+				arena->map(p_beg, p_end);
+				arena->map(s_beg, s_end);
+				if (!guarded || program_stale)
+					copy_program(arena->data() + p_beg);
+				else
+					std::memcpy(arena->data() + p_beg, guarded->data() + p_beg, p_end - p_beg);
+				std::memcpy(arena->data() + s_beg, guarded ? guarded->data() + old_s_beg : stack.data(), stack.size());
+				guarded = std::move(arena);
+				guarded_layout = std::move(layout);
+			}
+			program_stale = false;
+			arena_mem = guarded->data();
+		}
+		#else
+		if (memory == Memory::Guarded)
+			mem_path = Memory::Flat;
+		#endif
+		if (memory == Memory::Paged) // the regions map their own buffers, replacing the previous layout
+		{
+			if (!pages)
+				pages = std::make_unique<PageTable>();
+			// Pages shared with a fork are kept while the program and stack stay put
+			const bool keep = paged_stale && paged_regions.size() >= 2
+				&& paged_regions[0] == std::array{p_beg, p_end} && paged_regions[1] == std::array{s_beg, s_end};
+			if (!keep)
+				sync_buffers();
+			for (size_t i = keep ? 2 : 0; i < paged_regions.size(); ++i)
+				pages->unmap(paged_regions[i][0], paged_regions[i][1] - paged_regions[i][0]);
+			if (!keep)
+			{
+				map_program_pages();
+				pages->map(s_beg, stack.data(), stack.size(), Perm::RW);
+			}
+			paged_regions = {{p_beg, p_end}, {s_beg, s_end}};
+			for (const auto& region : data_regions)
+			{
+				pages->map(region.beg, region.mem.data(), region.mem.size(), region.read_only ? Perm::R : Perm::RW);
+				paged_regions.push_back({region.beg, region.end});
+			}
+		}
+		if (mem_path == Memory::Flat)
+		{
+			if (flat.size() != s_end || program_stale)
+			{
+				Bytes arena(s_end); // the pages below p_beg are never touched
+				const bool fresh = flat.empty();
+				if (fresh || program_stale)
+					copy_program(arena.data() + p_beg);
+				else
+					std::memcpy(arena.data() + p_beg, flat.data() + p_beg, p_end - p_beg);
+				std::memcpy(arena.data() + s_beg, fresh ? stack.data() : flat.data() + old_s_beg, stack.size());
+				flat = std::move(arena);
+			}
+			program_stale = false;
+			arena_mem = flat.data();
+		}
+		prog_mem = arena_mem ? arena_mem + shared_end : program.data();
+		shared_mem = arena_mem ? arena_mem + p_beg : image ? image->bytes.data() : nullptr;
+		stack_mem = arena_mem ? arena_mem + s_beg : stack.data();
+	}
+
+	PageTable& page_table()
+	{
+		if (!pages)
+			throw std::logic_error("Page mappings need Memory::Paged");
+		return *pages;
+	}
+
+	// A new program image was loaded: re-decode it, and have the next reset() lay it out
+	void program_changed()
+	{
+		prog_mem = program.data();
+		shared_mem = image ? image->bytes.data() : nullptr;
+		program_stale = arena_mem != nullptr;
+		if (paged_stale) // only the stack is still wanted from the pages
+		{
+			stack.resize(paged_sizes[1]);
+			pages->peek(paged_regions[1][0], stack.data(), stack.size());
+			paged_stale = false;
+		}
+		if (pages) // map the new image to decode it; reset() maps the rest of the layout
+		{
+			for (const auto& [beg, end] : paged_regions)
+				pages->unmap(beg, end - beg);
+			map_program_pages();
+			paged_regions = {{p_beg, shared_end + program.size()}};
+		}
+		predecode_program();
+	}
+
+	// Bring the program and stack buffers up to date from the arena or pages holding them
+	void sync_buffers()
+	{
+		if (arena_mem)
+		{
+			std::memcpy(program.data(), arena_mem + shared_end, program.size());
+			std::memcpy(stack.data(), arena_mem + s_beg, stack.size());
+		}
+		if (paged_stale) // as laid out when the pages were forked
+		{
+			program.resize(paged_sizes[0]);
+			stack.resize(paged_sizes[1]);
+			pages->peek(shared_end, program.data(), program.size());
+			pages->peek(paged_regions[1][0], stack.data(), stack.size());
+			paged_stale = false;
+		}
+	}
+
+	// Snapshot file layout (see snapshot_save()): this header, then its sections at page aligned offsets
+	struct SnapshotHeader
+	{
+		char magic[8];              // snapshot_magic
+		u32 version;                // snapshot_version
+		u32 header_size;            // sizeof(SnapshotHeader)
+		u64 pc;
+		std::array<u64,32> x;
+		u64 memory;                 // Memory backing
+		u64 shared_end;             // End of the shared part of the program image (p_beg if none)
+		u64 p_beg, p_end, s_beg, s_end; // Layout
+		u64 region_count;           // Data regions, each {beg, capacity, size, read_only, contents offset}
+		u64 extra_count;            // State kept by a derived VM (see snapshot_extra())
+		u64 root_count;             // Where the code was verified from (see VerifiedCode::roots)
+		u64 program_off, stack_off, regions_off, extra_off, roots_off; // Section offsets
+		u64 file_size;
+	};
+	static constexpr char snapshot_magic[8] = {'T','R','V','6','4','S','N','P'};
+	static constexpr u32 snapshot_version = 3;
+
+	// State of a derived VM to save with a snapshot, and to restore from one
+	//   restoring throws if the values don't suit this VM
+	virtual std::vector<u64> snapshot_extra() const { return {}; }
+	virtual void snapshot_restore_extra(std::span<const u64> extra)
+	{
+		if (!extra.empty())
+			throw std::invalid_argument("Snapshot is of another kind of VM");
+	}
+
+	// Set up child as a copy of this VM (see fork()); child was constructed with the same stack size and engine
+	void fork_into(VM& child)
+	{
+		child.image = image;
+		child.verified = verified;
+		child.p_beg = p_beg;
+		child.shared_end = shared_end;
+		child.data_regions = data_regions;
+		child.data_single = data_single;
+		child.memory = memory;
+		if (pages) // hand the program and stack buffers over to the page table, to share with the copy
+		{
+			if (!paged_stale)
+			{
+				paged_sizes = {program.size(), stack.size()};
+				for (auto [buf, vaddr] : {std::pair{&program, shared_end}, std::pair{&stack, s_beg}})
+				{
+					const size_t size = buf->size();
+					pages->adopt(vaddr, size, std::make_shared<const Bytes>(std::move(*buf)));
+					*buf = {};
+				}
+				paged_stale = true;
+			}
+			child.pages = pages->fork();
+			child.paged_regions = paged_regions;
+			child.paged_stale = true;
+			child.paged_sizes = paged_sizes;
+			child.stack = {};
+		}
+		else
+		{
+			sync_buffers();
+			child.program = program;
+			child.stack = stack;
+		}
+		child.decoded_own = decoded_own;
+		child.decoded = decoded_own.empty() ? decoded : std::span<DecodedOp>(child.decoded_own);
+		child.decoded_end = decoded_end;
+		child.flush_blocks();
+		child.reset();
+		child.x = x;
+		child.pc = pc;
+	}
+
+	// Map the program in pages: a shared image part is executable but not writable
+	void map_program_pages()
+	{
+		if (shared_end != p_beg)
+			pages->map(p_beg, const_cast<u8*>(image->bytes.data()), shared_end - p_beg, Perm::RX);
+		pages->map(shared_end, program.data(), program.size(), shared_end != p_beg ? Perm::RW : Perm::RWX);
+	}
+
+	// Copy the whole program image (shared part and own copy) to dst, the host address of p_beg
+	void copy_program(u8* const dst) const
+	{
+		if (shared_end != p_beg)
+			std::memcpy(dst, image->bytes.data(), shared_end - p_beg);
+		std::memcpy(dst + (shared_end - p_beg), program.data(), program.size());
+	}
+
+	// End of the executable program: with a shared image, only its shared part runs
+	u64 code_end() const { return shared_end != p_beg ? shared_end : p_beg + program_bytes(); }
+
+	// Where the program halts: the first word past it (p_end rounded up), its return address to start with
+	u64 halt_pc() const { return (shared_end + program_bytes() + 3) & ~3ull; }
+
+	// Program (own part) and stack sizes, whether their buffers are current or not (see paged_stale)
+	size_t program_bytes() const { return paged_stale ? paged_sizes[0] : program.size(); }
+	size_t stack_bytes() const { return paged_stale ? paged_sizes[1] : stack.size(); }
+
+	// Run an engine loop; with Memory::Guarded a fault in the arena is reported as an out of bounds access
+	//   the engines keep their progress in members and RunLimits, which the fault leaves as they were stored
+	//   before the access (see mem_ptr()), and their locals are dropped without destructors
+	template<typename F>
+	void guest_run(F&& f)
+	{
+		static_assert(std::is_trivially_destructible_v<RunLimits> && std::is_trivially_destructible_v<DecodedOp>
+			&& std::is_trivially_destructible_v<JitContext>, "Engine locals are dropped by a guarded fault");
+		#if defined(TINYRISCV64_GUARD)
+		if (mem_path == Memory::Guarded)
+			return guarded->run(std::forward<F>(f));
+		#endif
+		f();
+	}
+
+	// Host code accesses Memory::Guarded through the region checks for its lifetime:
+	//   a fault can't unwind the host frames in between (see GuardedArena::run())
+	class HostAccess
+	{
+	public:
+		explicit HostAccess(VM& vm) : vm(vm), path(vm.mem_path)
+		{
+			if (path == Memory::Guarded)
+				vm.mem_path = Memory::Regions;
+		}
+		~HostAccess() { vm.mem_path = path; }
+		HostAccess(const HostAccess&) = delete;
+		HostAccess& operator=(const HostAccess&) = delete;
+	private:
+		VM& vm;
+		const Memory path;
+	};
+
+	// End a run() with RunStatus::Yield once the current instruction retires (from an ECALL handler, say)
+	//   the next run() continues after it; returns false under execute_program(), which runs on instead
+	bool yield_program()
+	{
+		if (!in_run)
+			return false;
+		yielded = true;
+		halted = true;
+		return true;
+	}
+
+	// Run the selected engine from pc until the program halts, faults (throws) or has run
+	//   max_instructions (setting fuel_out), counting the instructions retired
+	void run_engine(const size_t max_instructions)
+	{
+		if(code_end() < p_beg + 4)
+			throw std::runtime_error("Program too small (must be at least 4 bytes)");
+
+		fuel_out = false;
+		retired = 0;
+		auto run = run_limits(max_instructions);
+		// the count goes one past the budget when it runs out
+		const auto count = [&] { retired = std::min(run.count, run.max); };
+		try
+		{
+			guest_run([&] {
+				switch(engine)
+				{
+					case Engine::Predecode: run_predecoded(run); break;
+					case Engine::Threaded:  run_threaded(run); break;
+					case Engine::TailCall:  run_tailcall(run); break;
+					case Engine::Block:     run_blocks<false>(run); break;
+					case Engine::JIT:       run_blocks<true>(run); break;
+					default:                run_interpreter(run); break;
+				}
+			});
+		}
+		catch (...)
+		{
+			// A faulting block's ops are counted up to the faulting one, which already advanced pc
+			if (block_running != no_block)
+			{
+				const u64 done = (pc - op_addr(blocks[block_running].first)) / 4;
+				if (done && done <= blocks[block_running].len)
+					run.count += done;
+				block_running = no_block;
+			}
+			count();
+			throw;
+		}
+		count();
+	}
+
+	// Load program from file
+	static Bytes load_program(const std::string& filename, const size_t max_size)
+	{
+		std::ifstream fin(filename, std::ios::binary | std::ios::ate);
+		if (!fin)
+			throw std::invalid_argument("Failed to open program file: " + filename);
+
+		size_t size = fin.tellg();
+		if (size > max_size)
+			throw std::invalid_argument(std::format("Program too large (max {})", max_size));
+
+		fin.seekg(0, std::ios::beg);
+		Bytes prog(size);
+		fin.read(reinterpret_cast<char*>(prog.data()), size);
+		return prog;
+	}
+
+	void run_interpreter(RunLimits& run)
+	{
+		while (!halted)
+		{
+			if (run.outside(pc)) [[unlikely]]
+				throw std::runtime_error("PC jumped program region");
+			if (++run.count > run.max) [[unlikely]]
+			{
+				fuel_out = true;
+				return;
+			}
+
+			execute_instruction();
+
+			if(pc == run.sentinel_pc) [[unlikely]]
+				halted = true;
+		}
+	}
+
+	RunLimits run_limits(const size_t max_instructions) const
+	{
+		return {p_beg, code_end() - 4 - p_beg, halt_pc(), 0, max_instructions};
+	}
+
+	// Advance to the next decoded op, applying the same checks as run_interpreter()
+	//   returns nullptr once halted or out of fuel; misaligned pcs are executed from program memory
+	TINYRISCV64_INLINE const DecodedOp* next_op(RunLimits& run)
+	{
+		while (!halted)
+		{
+			if (run.outside(pc)) [[unlikely]]
+				throw std::runtime_error("PC jumped program region");
+			if (++run.count > run.max) [[unlikely]]
+			{
+				fuel_out = true;
+				return nullptr;
+			}
+
+			if (!(pc & 3)) [[likely]]
+				return op_at(run);
+
+			execute_instruction();
+
+			if(pc == run.sentinel_pc) [[unlikely]]
+				halted = true;
+		}
+		return nullptr;
+	}
+
+	// The (counted) decoded op at a word aligned pc in the code
+	TINYRISCV64_INLINE const DecodedOp* op_at(RunLimits& run)
+	{
+		const DecodedOp* const d = &decoded[op_index(pc)];
+		if (is_fused(d->op))
+		{
+			// Count the whole idiom, or run just its first op if the budget ends inside it
+			const size_t extra = op_width(d->op) - 1;
+			if (run.count + extra > run.max) [[unlikely]]
+			{
+				unfused = *d;
+				unfused.op = base_op(d->op);
+				return &unfused;
+			}
+			run.count += extra;
+		}
+		return d;
+	}
+
+	// Whether the pc must be checked after op: it's set by an indirect jump or SYSTEM op, or the op is
+	//   decoded as it runs; every other op was decoded knowing that its fall-through and any direct target
+	//   are words of the code or the sentinel (see decode_in_code())
+	static constexpr bool checks_pc(Op op)
+	{
+		op = fused_parts(op).part[op_width(op) - 1];
+		return op == Op::JALR || op == Op::INTERP || op == Op::DECODE;
+	}
+
+	// Check for return to the sentinel after a decoded op (for which checks_pc() gave CheckPc), then advance
+	template<bool CheckPc>
+	TINYRISCV64_INLINE const DecodedOp* retire_op(RunLimits& run)
+	{
+		if(pc == run.sentinel_pc) [[unlikely]]
+			halted = true;
+		if constexpr (CheckPc)
+			return next_op(run);
+		if (halted) [[unlikely]]
+			return nullptr;
+		if (++run.count > run.max) [[unlikely]]
+		{
+			fuel_out = true;
+			return nullptr;
+		}
+		return op_at(run);
+	}
+
+	// retire_op() after an op known only at run time
+	TINYRISCV64_INLINE const DecodedOp* retire_op(RunLimits& run, const Op op)
+	{
+		static constexpr bool check_pc[] = {
+			#define TINYRISCV64_OP_CHECK_PC(name) checks_pc(Op::name),
+			TINYRISCV64_OPS(TINYRISCV64_OP_CHECK_PC)
+			#undef TINYRISCV64_OP_CHECK_PC
+		};
+		return check_pc[static_cast<u8>(op)] ? retire_op<true>(run) : retire_op<false>(run);
+	}
+
+	void run_predecoded(RunLimits& run)
+	{
+		for (auto d = next_op(run); d; d = retire_op(run, d->op))
+			execute_decoded(*d);
+	}
+
+	// Direct-threaded dispatch: every handler ends in its own indirect jump,
+	//   so the host predictor keeps separate history per op
+	#if defined(TINYRISCV64_COMPUTED_GOTO)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wpedantic"
+	void run_threaded(RunLimits& run)
+	{
+		static const void* const labels[] = {
+			#define TINYRISCV64_OP_LABEL(name) &&op_##name,
+			TINYRISCV64_OPS(TINYRISCV64_OP_LABEL)
+			#undef TINYRISCV64_OP_LABEL
+		};
+
+		const DecodedOp* d = next_op(run);
+		if (!d) return;
+		goto *labels[static_cast<u8>(d->op)];
+
+		#define TINYRISCV64_OP_HANDLER(name)                        \
+		op_##name:                                                  \
+			exec_op<Op::name>(*d);                                  \
+			if (!(d = retire_op<checks_pc(Op::name)>(run))) return; \
+			goto *labels[static_cast<u8>(d->op)];
+		TINYRISCV64_OPS(TINYRISCV64_OP_HANDLER)
+		#undef TINYRISCV64_OP_HANDLER
+	}
+	#pragma GCC diagnostic pop
+	#else
+	void run_threaded(RunLimits& run) { run_predecoded(run); }
+	#endif
+
+	// Tail-call dispatch: each handler jumps straight to the next op's handler
+	using TailOp = void(*)(VM&, const DecodedOp*, RunLimits&);
+
+	static const TailOp* tail_ops()
+	{
+		static constexpr TailOp ops[] = {
+			#define TINYRISCV64_OP_TAIL(name) &VM::tail_op<Op::name>,
+			TINYRISCV64_OPS(TINYRISCV64_OP_TAIL)
+			#undef TINYRISCV64_OP_TAIL
+		};
+		return ops;
+	}
+
+	template<Op O>
+	static void tail_op(VM& vm, const DecodedOp* d, RunLimits& run)
+	{
+		vm.exec_op<O>(*d);
+		#if defined(TINYRISCV64_MUSTTAIL)
+		if (!(d = vm.template retire_op<checks_pc(O)>(run))) return;
+		TINYRISCV64_MUSTTAIL return tail_ops()[static_cast<u8>(d->op)](vm, d, run);
+		#else
+		if(vm.pc == run.sentinel_pc) [[unlikely]]
+			vm.halted = true;
+		#endif
+	}
+
+	void run_tailcall(RunLimits& run)
+	{
+		#if defined(TINYRISCV64_MUSTTAIL)
+		if (auto d = next_op(run))
+			tail_ops()[static_cast<u8>(d->op)](*this, d, run);
+		#else
+		for (auto d = next_op(run); d; d = next_op(run))
+			tail_ops()[static_cast<u8>(d->op)](*this, d, run);
+		#endif
+	}
+
+	// Basic-block engine: the bounds, budget, sentinel and halt checks run once per block,
+	//   and blocks link directly to the successors they branch or fall through to
+	//   with Jit, blocks that run jit_threshold times are compiled to machine code
+	template<bool Jit>
+	void run_blocks(RunLimits& run)
+	{
+		u32 b = no_block;
+		#if defined(TINYRISCV64_JIT)
+		JitContext ctx;
+		if constexpr (Jit)
+			jit_context(ctx);
+		#endif
+
+		while (!halted)
+		{
+			if (blocks_stale) [[unlikely]]
+			{
+				flush_blocks();
+				b = no_block;
+			}
+			// Follow the chain from the previous block (pc was checked when they were linked),
+			//   or look up / translate the block at pc
+			u32 next;
+			if (b != no_block && blocks[b].succ_pc[0] == pc && blocks[b].succ[0] != no_block)
+				next = blocks[b].succ[0];
+			else if (b != no_block && blocks[b].succ_pc[1] == pc && blocks[b].succ[1] != no_block)
+				next = blocks[b].succ[1];
+			else
+			{
+				if (run.outside(pc)) [[unlikely]]
+					throw std::runtime_error("PC jumped program region");
+				if (pc & 3) [[unlikely]] // decoded ops are word aligned
+				{
+					if (++run.count > run.max)
+					{
+						fuel_out = true;
+						return;
+					}
+					execute_instruction();
+					if(pc == run.sentinel_pc)
+						halted = true;
+					b = no_block;
+					continue;
+				}
+				next = block_at[op_index(pc)];
+				if (next == no_block)
+					next = translate_block(pc);
+				if (b != no_block)
+					link_block(blocks[b], pc, next);
+			}
+			b = next;
+
+			Block& blk = blocks[b];
+			if (run.count + blk.len > run.max) [[unlikely]]
+			{
+				// Not enough budget for the whole block: finish one op at a time
+				for (auto d = next_op(run); d; d = retire_op(run, d->op))
+					execute_decoded(*d);
+				return;
+			}
+
+			#if defined(TINYRISCV64_JIT)
+			if constexpr (Jit)
+			{
+				if (!blk.code && blk.hits < jit_threshold && ++blk.hits == jit_threshold)
+					blk.code = jit_compile(blk);
+				if (blk.code)
+				{
+					const u64 ran = blk.code(&ctx);
+					pc = ctx.pc;
+					run.count += ran & ~jit_interp;
+					if (ran & jit_interp)
+					{
+						// SYSTEM op, program store or fault: the interpreter runs (or reports) it
+						++run.count;
+						execute_decoded(decoded[op_index(pc)]);
+						jit_context(ctx);
+						b = no_block;
+					}
+					if(pc == run.sentinel_pc) [[unlikely]]
+						halted = true;
+					continue;
+				}
+			}
+			#endif
 
-	// Virtual addressing:
-	static constexpr
-	u64 p_beg = 0;   // Program mem begin
-	u64 p_end;       // Program mem end
-							/* 64 overflow detection addresses */
-	u64 d_beg;       // Data mem begin
-	u64 d_end;       // Data mem end
-							/* 64 overflow detection addresses */
-	u64 s_beg;       // Stack mem begin
-	u64 s_end;       // Stack mem end
+			block_running = b;
+			run.count += exec_block(blk);
+			block_running = no_block;
+			#if defined(TINYRISCV64_JIT)
+			if constexpr (Jit)
+				jit_context(ctx);
+			#endif
 
-public:
-	VM(const size_t stack_size = 4096, const size_t max_program_size = 1024UL*1024)
-		: stack(stack_size), max_prog_size(max_program_size) { reset(); }
+			if(pc == run.sentinel_pc) [[unlikely]]
+				halted = true;
+		}
+	}
 
-	// Load program from file and return the virtual start addr
-	//   resets state and invalidates previous virtual addrs
-	virtual u64 program_load(const std::string& prog_filename)
+	// Run ahead-of-time translated code (see Test/aot)
+	//   block(addr, budget) runs the translated block starting at addr and returns how many
+	//   instructions ran, or 0 if none starts there or it needs more than budget; the
+	//   instruction at pc is then interpreted, so untranslated targets still run
+	template<typename TranslatedBlock>
+	void run_translated(const u64 entry_point, const size_t max_instructions, TranslatedBlock&& block)
 	{
-		program = load_program(prog_filename, max_prog_size);
-		reset();
-		return p_beg;
+		pc = entry_point == base_entry ? p_beg : entry_point;
+		halted = false;
+
+		if(code_end() < p_beg + 4)
+			throw std::runtime_error("Program too small (must be at least 4 bytes)");
+
+		guest_run([&] {
+			auto run = run_limits(max_instructions);
+			while (!halted)
+			{
+				if (run.outside(pc)) [[unlikely]]
+					throw std::runtime_error("PC jumped program region");
+
+				if (const size_t ran = block(pc, run.max - run.count))
+					run.count += ran;
+				else
+				{
+					if (++run.count > run.max) [[unlikely]]
+						throw std::runtime_error("Maximum instruction count exceeded");
+					execute_instruction();
+				}
+
+				if(pc == run.sentinel_pc) [[unlikely]]
+					halted = true;
+			}
+		});
 	}
 
-	// Copy bytecode and return the starting virtual addr
-	//   resets state and invalidates previous virtual addrs
-	u64 program_load(const u8* const prog, size_t prog_size)
+	// Run the ops of a block and return how many ran
+	//   stops early if a store rewrote program memory under a block
+	TINYRISCV64_INLINE size_t exec_block(const Block& blk)
 	{
-		if (prog_size > max_prog_size)
-			throw std::invalid_argument(std::format("Program too large (max {} bytes)", max_prog_size));
-		program.resize(prog_size);
-		std::memcpy(program.data(), prog, prog_size);
-		reset();
-		return p_beg;
+		const DecodedOp* const begin = &decoded[blk.first];
+		const DecodedOp* const end = begin + blk.len;
+		for (const DecodedOp* d = begin; d != end; )
+		{
+			switch(d->op)
+			{
+				#define TINYRISCV64_OP_BLOCK_CASE(name)                               \
+				case Op::name:                                                    \
+					exec_op<Op::name>(*d);                                        \
+					d += op_width(Op::name);                                      \
+					if constexpr (Op::name >= Op::SB && Op::name <= Op::SD)       \
+						if (blocks_stale) [[unlikely]] return d - begin;          \
+					break;
+				TINYRISCV64_OPS(TINYRISCV64_OP_BLOCK_CASE)
+				#undef TINYRISCV64_OP_BLOCK_CASE
+			}
+		}
+		return blk.len;
 	}
 
-	// Map virtual addresses to the referenced data
-	//   resets state and invalidates previous virtual addrs
-	u64 map_data_mem(u8* const mem, const size_t mem_size)
+	static bool ends_block(Op op)
 	{
-		data = {mem,mem_size};
-		reset();
-		return d_beg;
+		op = fused_parts(op).part[op_width(op) - 1];
+		return op == Op::JAL || op == Op::JALR || (op >= Op::BEQ && op <= Op::BGEU) || op == Op::INTERP || op == Op::DECODE;
 	}
 
-	// Set register value (x0-x31, x0 is always 0)
-	void register_set(const size_t reg, const u64 value)
+	// Discover the basic block starting at (word aligned, in range) addr
+	u32 translate_block(const u64 addr)
 	{
-		if (reg < 0 || reg >= 32)
-			throw std::invalid_argument("Invalid register number");
-		if (reg != 0) x[reg] = value;
+		Block blk{static_cast<u32>(op_index(addr)), 0, {0, 0}, {no_block, no_block}, false, 0, nullptr};
+		size_t i = blk.first;
+		while (i < decoded.size())
+		{
+			if (decoded[i].op == Op::DECODE)
+				decoded[i] = decode_at(op_addr(i));
+			const Op op = decoded[i].op;
+			i += op_width(op);
+			if (ends_block(op))
+				break;
+		}
+		blk.len = static_cast<u32>(i - blk.first);
+
+		const auto& last = decoded[i-1];
+		const Op last_op = base_op(last.op);
+		blk.succ_pc[0] = op_addr(i);
+		if (last_op == Op::JAL || (last_op >= Op::BEQ && last_op <= Op::BGEU))
+			blk.succ_pc[1] = last.imm;
+		blk.indirect = (last_op == Op::JALR);
+
+		if (blocks.empty() || blk.first < blocks_lo) blocks_lo = blk.first;
+		if (blocks.empty() || i > blocks_hi) blocks_hi = i;
+
+		blocks.push_back(blk);
+		return block_at[blk.first] = static_cast<u32>(blocks.size() - 1);
 	}
 
-	// Get register value
-	u64 register_get(const size_t reg) const
+	// Chain a block to the successor found at addr
+	static void link_block(Block& blk, const u64 addr, const u32 next)
 	{
-		if (reg < 0 || reg >= 32)
-			throw std::invalid_argument("Invalid register number");
-		return x[reg];
+		if (blk.succ_pc[0] == addr)
+			blk.succ[0] = next;
+		else if (blk.succ_pc[1] == addr || blk.indirect) // JALR chains to its most recent target
+		{
+			blk.succ_pc[1] = addr;
+			blk.succ[1] = next;
+		}
 	}
 
-	// Push a value onto the stack and return the virtual address (stack pointer)
-	template<typename T>
-	u64 stack_push(const T& val)
+	void flush_blocks()
 	{
-		x[2] -= sizeof(T);
-		mem_store(x[2],val);
-		return x[2];
+		blocks.clear();
+		block_at.assign(engine == Engine::Block || engine == Engine::JIT ? decoded.size() : 0, no_block);
+		#if defined(TINYRISCV64_JIT)
+		if (jit)
+			jit->clear();
+		#endif
+		blocks_lo = blocks_hi = 0;
+		blocks_stale = false;
 	}
 
-	template<typename T>
-	T stack_pop()
+#if defined(TINYRISCV64_JIT)
+	void jit_context(JitContext& ctx)
 	{
-		x[2] += sizeof(T);
-		return mem_load<T>(x[2]-sizeof(T));
+		ctx.x = x.data();
+		ctx.vm = this;
+		ctx.p_beg = shared_end;
+		ctx.p_end = p_end;
+		ctx.p_host = reinterpret_cast<u64>(prog_mem) - shared_end;
+		ctx.r_beg = p_beg;
+		ctx.r_end = shared_end;
+		ctx.r_host = reinterpret_cast<u64>(shared_mem) - p_beg;
+		ctx.tlb = pages ? reinterpret_cast<u64>(pages->tlb_data()) : 0;
+		// Memory::Guarded keeps the region checks: a fault would lose the guest registers cached in host registers
+		// Several or read-only data regions go through the interpreter
+		const auto& data = data_regions.front();
+		ctx.d_beg = data_single ? data.beg : 0;
+		ctx.d_end = data_single ? data.end : 0;
+		ctx.d_host = data_single ? reinterpret_cast<u64>(data.mem.data()) - data.beg : 0;
+		ctx.s_beg = s_beg;
+		ctx.s_end = s_end;
+		ctx.s_host = reinterpret_cast<u64>(stack_mem) - s_beg;
 	}
 
-	template<typename T>
-	T stack_peek()
+	// Called by compiled code after a store to program memory; returns non-zero if a block was overwritten
+	static u64 jit_program_store(VM* vm, const u64 addr, const u64 len)
 	{
-		return mem_load<T>(x[2]);
+		if (addr < vm->decoded_end)
+			vm->invalidate_decoded(addr, len);
+		return vm->blocks_stale;
 	}
 
-	// Execute program
-	void execute_program(const u64 entry_point = p_beg, const size_t max_instructions = 100000)
+	// DIV/REM family, with the same results as exec_alu_reg()/exec_alu_reg32()
+	static u64 jit_div(const u64 a, const u64 b, const u64 op)
 	{
-		const auto prog_sz = program.size();
-		const auto sentinel_pc = ((prog_sz + 3) & ~3ull);
+		const auto sa = static_cast<i64>(a);
+		const auto sb = static_cast<i64>(b);
+		const auto a32 = static_cast<u32>(a), b32 = static_cast<u32>(b);
+		const auto sa32 = static_cast<i32>(a32), sb32 = static_cast<i32>(b32);
+		switch(static_cast<Op>(op))
+		{
+			case Op::DIV: return b ? (sa == INT64_MIN && sb == -1 ? a : static_cast<u64>(sa / sb)) : ~0ULL;
+			case Op::DIVU: return b ? a / b : ~0ULL;
+			case Op::REM: return b ? (sa == INT64_MIN && sb == -1 ? 0 : static_cast<u64>(sa % sb)) : a;
+			case Op::REMU: return b ? a % b : a;
+			case Op::DIVW: return static_cast<i64>(b32 ? (sa32 == INT32_MIN && sb32 == -1 ? sa32 : sa32 / sb32) : -1);
+			case Op::DIVUW: return static_cast<i64>(static_cast<i32>(b32 ? a32 / b32 : ~0u));
+			case Op::REMW: return static_cast<i64>(b32 ? (sa32 == INT32_MIN && sb32 == -1 ? 0 : sa32 % sb32) : sa32);
+			default: return static_cast<i64>(static_cast<i32>(b32 ? a32 % b32 : a32)); // REMUW
+		}
+	}
 
-		pc = entry_point;
-		halted = false;
-		size_t count = 0;
+	static bool jit_supported(const Op op) { return base_op(op) != Op::INTERP && op != Op::DECODE; }
 
-		if(prog_sz < 4)
-			throw std::runtime_error("Program too small (must be at least 4 bytes)");
+	// Compile a block to x86-64
+	//   The most used guest registers live in callee-saved host registers, memory accesses are
+	//   bounds checked inline, and anything else (SYSTEM ops, faults) exits to the interpreter
+	JitFn jit_compile(const Block& blk)
+	{
+		using E = X64Emitter;
+		const DecodedOp* const ops = &decoded[blk.first];
+		size_t k = 0; // ops compiled
+		while (k < blk.len && jit_supported(ops[k].op))
+			++k;
+		if (k == 0)
+			return nullptr;
+
+		if (!jit)
+			jit = std::make_unique<X64Emitter>();
+		if (jit->space() < 512 + k*384)
+		{
+			if (512 + k*384 > jit->pos() + jit->space())
+				return nullptr;
+			// Cache full: drop all compiled code and start again
+			jit->clear();
+			for (auto& other : blocks)
+			{
+				other.code = nullptr;
+				other.hits = 0;
+			}
+		}
 
-		while (!halted)
+		const bool paged = mem_path == Memory::Paged;
+
+		// Cache the most used registers
+		std::array<u32,32> uses{};
+		for (size_t i = 0; i < k; ++i)
 		{
-			if (pc > prog_sz-4) [[unlikely]]
-				throw std::runtime_error("PC jumped program region");
-			if (++count > max_instructions) [[unlikely]]
-				throw std::runtime_error("Maximum instruction count exceeded");
+			++uses[ops[i].rs1];
+			++uses[ops[i].rs2];
+			++uses[ops[i].rd];
+		}
+		uses[0] = 0;
+		constexpr E::Reg host_regs[] = {E::rbp, E::r13, E::r14, E::r15};
+		std::array<i8,32> host_of;
+		host_of.fill(-1);
+		for (u8 h = 0; h < 4; ++h)
+		{
+			const auto best = std::max_element(uses.begin(), uses.end()) - uses.begin();
+			if (uses[best] < 2)
+				break;
+			host_of[best] = h;
+			uses[best] = 0;
+		}
 
-			execute_instruction();
+		E& a = *jit;
+		a.writable(true);
+		const size_t start = a.pos();
+		const i32 ctx_pc = offsetof(JitContext, pc);
+
+		a.push(E::rbx); a.push(E::rbp); a.push(E::r12); a.push(E::r13); a.push(E::r14); a.push(E::r15);
+		a.alu_imm(E::SUB, E::rsp, 8);
+		a.mov(E::rbx, E::rdi);
+		a.load(E::r12, E::rbx, offsetof(JitContext, x));
+		for (u8 r = 1; r < 32; ++r)
+			if (host_of[r] >= 0)
+				a.load(host_regs[host_of[r]], E::r12, r*8);
+		a.store_imm(E::r12, 0, 0); // x0 is zeroed before each op
+
+		// Guest register access
+		auto get = [&](const u8 r, const E::Reg tmp) -> E::Reg {
+			if (r == 0) { a.alu(E::XOR, tmp, tmp, false); return tmp; }
+			if (host_of[r] >= 0) return host_regs[host_of[r]];
+			a.load(tmp, E::r12, r*8);
+			return tmp;
+		};
+		auto get_to = [&](const u8 r, const E::Reg dst) { a.mov(dst, get(r, dst)); };
+		auto set = [&](const u8 r, const E::Reg src) {
+			if (r == 0) return;
+			if (host_of[r] >= 0) a.mov(host_regs[host_of[r]], src);
+			else a.store(E::r12, r*8, src);
+		};
+
+		// Exits back to run_blocks(): {jump to patch, pc, return value}
+		struct Exit { size_t fixup; u64 pc; u64 ret; };
+		std::vector<Exit> exits;
+
+		for (size_t i = 0; i < k; ++i)
+		{
+			const DecodedOp& d = ops[i];
+			const u64 op_pc = op_addr(blk.first + i);
+			const auto imm = static_cast<i32>(d.imm);
+
+			// Binary ops: rax = rs1 OP rs2
+			auto alu_rr = [&](const E::Alu op, const bool w) {
+				get_to(d.rs1, E::rax);
+				a.alu(op, E::rax, get(d.rs2, E::rcx), w);
+				if (!w) a.movsxd(E::rax, E::rax);
+				set(d.rd, E::rax);
+			};
+			auto alu_ri = [&](const E::Alu op, const bool w) {
+				get_to(d.rs1, E::rax);
+				a.alu_imm(op, E::rax, imm, w);
+				if (!w) a.movsxd(E::rax, E::rax);
+				set(d.rd, E::rax);
+			};
+			auto shift_rr = [&](const E::Shift op, const bool w) {
+				get_to(d.rs2, E::rcx);
+				get_to(d.rs1, E::rax);
+				a.shift_cl(op, E::rax, w);
+				if (!w) a.movsxd(E::rax, E::rax);
+				set(d.rd, E::rax);
+			};
+			auto shift_ri = [&](const E::Shift op, const bool w) {
+				get_to(d.rs1, E::rax);
+				a.shift_imm(op, E::rax, static_cast<u8>(d.imm), w);
+				if (!w) a.movsxd(E::rax, E::rax);
+				set(d.rd, E::rax);
+			};
+			auto set_rr = [&](const E::Cond cc) {
+				get_to(d.rs1, E::rax);
+				a.alu(E::CMP, E::rax, get(d.rs2, E::rcx));
+				a.setcc_movzx(cc, E::rax);
+				set(d.rd, E::rax);
+			};
+			auto set_ri = [&](const E::Cond cc) {
+				get_to(d.rs1, E::rax);
+				a.alu_imm(E::CMP, E::rax, imm);
+				a.setcc_movzx(cc, E::rax);
+				set(d.rd, E::rax);
+			};
+			auto mul_hi = [&](const bool is_signed, const bool su) {
+				get_to(d.rs1, E::rax);
+				get_to(d.rs2, E::rcx);
+				if (su) a.mov(E::rsi, E::rax);
+				a.mul_rdx_rax(E::rcx, is_signed);
+				if (su) // mulhu(a,b) - (a < 0 ? b : 0)
+				{
+					a.shift_imm(E::SAR, E::rsi, 63);
+					a.alu(E::AND, E::rsi, E::rcx);
+					a.alu(E::SUB, E::rdx, E::rsi);
+				}
+				set(d.rd, E::rdx);
+			};
+			auto div = [&]() {
+				get_to(d.rs1, E::rdi);
+				get_to(d.rs2, E::rsi);
+				a.mov_imm(E::rdx, static_cast<u64>(d.op));
+				a.mov_imm(E::rax, reinterpret_cast<u64>(&jit_div));
+				a.call(E::rax);
+				set(d.rd, E::rax);
+			};
+			// Bounds check the access at rs1+imm, leaving its host address in rax (see mem_ptr())
+			//   program region stores call back into the VM so decoded ops are invalidated
+			auto mem = [&](const u8 size, const bool store, auto&& access) {
+				get_to(d.rs1, E::rax);
+				a.alu_imm(E::ADD, E::rax, imm);
+				if (store)
+					get_to(d.rs2, E::rcx);
+				if (paged)
+				{
+					// Look the page up in the TLB; a miss, or an access crossing the page, is interpreted
+					using P = PageTable;
+					a.mov(E::rsi, E::rax);
+					a.shift_imm(E::SHR, E::rsi, P::page_bits);
+					a.alu_imm(E::AND, E::rsi, P::tlb_size - 1);
+					a.shift_imm(E::SHL, E::rsi, 5);
+					static_assert(sizeof(P::TlbEntry) == 1 << 5);
+					a.alu_mem(E::ADD, E::rsi, E::rbx, offsetof(JitContext, tlb));
+					a.mov(E::rdx, E::rax);
+					a.alu_imm(E::AND, E::rdx, P::page_mask);
+					a.alu_imm(E::CMP, E::rdx, P::page_size - size);
+					exits.push_back({a.jcc(E::A), op_pc, i | jit_interp});
+					a.mov(E::rdx, E::rax);
+					a.alu_imm(E::AND, E::rdx, static_cast<i32>(~P::page_mask));
+					a.alu_mem(E::CMP, E::rdx, E::rsi, store ? offsetof(P::TlbEntry, write) : offsetof(P::TlbEntry, read));
+					exits.push_back({a.jcc(E::NE), op_pc, i | jit_interp});
+					a.mov(E::rdi, E::rax);
+					a.alu_mem(E::ADD, E::rax, E::rsi, offsetof(P::TlbEntry, host));
+					access();
+					if (!store)
+					{
+						set(d.rd, E::rax);
+						return;
+					}
+					a.alu_mem(E::CMP, E::rdi, E::rbx, offsetof(JitContext, p_end));
+					const size_t data = a.jcc(E::AE);
+					a.mov(E::rsi, E::rdi);
+					a.load(E::rdi, E::rbx, offsetof(JitContext, vm));
+					a.mov_imm(E::rdx, size);
+					a.mov_imm(E::rax, reinterpret_cast<u64>(&jit_program_store));
+					a.call(E::rax);
+					a.alu_imm(E::CMP, E::rax, 0);
+					exits.push_back({a.jcc(E::NE), op_pc + 4, i + 1}); // a compiled block was overwritten
+					a.bind(data);
+					return;
+				}
+				a.alu_imm(E::CMP, E::rax, -16); // guard against wrap-around
+				exits.push_back({a.jcc(E::A), op_pc, i | jit_interp});
+				a.lea(E::rsi, E::rax, size - 1);
+				std::vector<size_t> done;
+				for (const auto [beg, end, host] : {
+					std::array<size_t,3>{offsetof(JitContext, s_beg), offsetof(JitContext, s_end), offsetof(JitContext, s_host)},
+					std::array<size_t,3>{offsetof(JitContext, d_beg), offsetof(JitContext, d_end), offsetof(JitContext, d_host)}})
+				{
+					a.alu_mem(E::CMP, E::rax, E::rbx, beg);
+					const size_t below = a.jcc(E::B);
+					a.alu_mem(E::CMP, E::rsi, E::rbx, end);
+					const size_t above = a.jcc(E::AE);
+					a.alu_mem(E::ADD, E::rax, E::rbx, host);
+					done.push_back(a.jmp());
+					a.bind(below);
+					a.bind(above);
+				}
+				if (!store) // a shared image part (see Image), empty otherwise
+				{
+					a.alu_mem(E::CMP, E::rax, E::rbx, offsetof(JitContext, r_beg));
+					exits.push_back({a.jcc(E::B), op_pc, i | jit_interp});
+					a.alu_mem(E::CMP, E::rsi, E::rbx, offsetof(JitContext, r_end));
+					const size_t above = a.jcc(E::AE);
+					a.alu_mem(E::ADD, E::rax, E::rbx, offsetof(JitContext, r_host));
+					done.push_back(a.jmp());
+					a.bind(above);
+				}
+				a.alu_mem(E::CMP, E::rsi, E::rbx, offsetof(JitContext, p_end));
+				exits.push_back({a.jcc(E::AE), op_pc, i | jit_interp});
+				a.alu_mem(E::CMP, E::rax, E::rbx, offsetof(JitContext, p_beg));
+				exits.push_back({a.jcc(E::B), op_pc, i | jit_interp});
+				if (store)
+				{
+					a.mov(E::rdi, E::rax);
+					a.alu_mem(E::ADD, E::rax, E::rbx, offsetof(JitContext, p_host));
+					access();
+					a.mov(E::rsi, E::rdi);
+					a.load(E::rdi, E::rbx, offsetof(JitContext, vm));
+					a.mov_imm(E::rdx, size);
+					a.mov_imm(E::rax, reinterpret_cast<u64>(&jit_program_store));
+					a.call(E::rax);
+					a.alu_imm(E::CMP, E::rax, 0);
+					exits.push_back({a.jcc(E::NE), op_pc + 4, i + 1}); // a compiled block was overwritten
+					const size_t skip = a.jmp();
+					for (const auto fixup : done)
+						a.bind(fixup);
+					access();
+					a.bind(skip);
+				}
+				else
+				{
+					a.alu_mem(E::ADD, E::rax, E::rbx, offsetof(JitContext, p_host));
+					for (const auto fixup : done)
+						a.bind(fixup);
+					access();
+					set(d.rd, E::rax);
+				}
+			};
+			auto load = [&](const u8 size, const bool w, const u8 opc, const bool two_byte) {
+				mem(size, false, [&]() {
+					if (two_byte) a.op0f_rm(w, opc, E::rax, E::rax, 0);
+					else a.op_rm(w, opc, E::rax, E::rax, 0);
+				});
+			};
+			auto store = [&](const u8 size) {
+				mem(size, true, [&]() {
+					if (size == 2) a.emit8(0x66);
+					a.op_rm(size == 8, size == 1 ? 0x88 : 0x89, E::rcx, E::rax, 0);
+				});
+			};
+			auto branch = [&](const E::Cond cc) {
+				get_to(d.rs1, E::rax);
+				a.alu(E::CMP, E::rax, get(d.rs2, E::rcx));
+				a.mov_imm(E::rax, op_pc + 4);
+				a.mov_imm(E::rdx, d.imm);
+				a.cmov(cc, E::rax, E::rdx);
+				a.store(E::rbx, ctx_pc, E::rax);
+			};
+			// A jump's link register is written even if it is x0, which is zeroed before the next op
+			auto link = [&]() {
+				a.mov_imm(E::rax, op_pc + 4);
+				if (d.rd == 0) a.store(E::r12, 0, E::rax);
+				else set(d.rd, E::rax);
+			};
+
+			switch(base_op(d.op)) // fused ops are compiled one part at a time
+			{
+				case Op::LI: if (d.rd) { a.mov_imm(E::rax, d.imm); set(d.rd, E::rax); } break;
+				case Op::JAL: link(); a.mov_imm(E::rax, d.imm); a.store(E::rbx, ctx_pc, E::rax); break;
+				case Op::JALR:
+					get_to(d.rs1, E::rax);
+					a.alu_imm(E::ADD, E::rax, imm);
+					a.alu_imm(E::AND, E::rax, -2);
+					a.store(E::rbx, ctx_pc, E::rax);
+					link();
+					break;
+				case Op::BEQ: branch(E::E); break;
+				case Op::BNE: branch(E::NE); break;
+				case Op::BLT: branch(E::L); break;
+				case Op::BGE: branch(E::GE); break;
+				case Op::BLTU: branch(E::B); break;
+				case Op::BGEU: branch(E::AE); break;
+				case Op::LB: load(1, true, 0xBE, true); break;
+				case Op::LH: load(2, true, 0xBF, true); break;
+				case Op::LW: load(4, true, 0x63, false); break;
+				case Op::LD: load(8, true, 0x8B, false); break;
+				case Op::LBU: load(1, false, 0xB6, true); break;
+				case Op::LHU: load(2, false, 0xB7, true); break;
+				case Op::LWU: load(4, false, 0x8B, false); break;
+				case Op::SB: store(1); break;
+				case Op::SH: store(2); break;
+				case Op::SW: store(4); break;
+				case Op::SD: store(8); break;
+				case Op::ADDI: alu_ri(E::ADD, true); break;
+				case Op::SLLI: shift_ri(E::SHL, true); break;
+				case Op::SLTI: set_ri(E::L); break;
+				case Op::SLTIU: set_ri(E::B); break;
+				case Op::XORI: alu_ri(E::XOR, true); break;
+				case Op::SRLI: shift_ri(E::SHR, true); break;
+				case Op::SRAI: shift_ri(E::SAR, true); break;
+				case Op::ORI: alu_ri(E::OR, true); break;
+				case Op::ANDI: alu_ri(E::AND, true); break;
+				case Op::ADDIW: alu_ri(E::ADD, false); break;
+				case Op::SLLIW: shift_ri(E::SHL, false); break;
+				case Op::SRLIW: shift_ri(E::SHR, false); break;
+				case Op::SRAIW: shift_ri(E::SAR, false); break;
+				case Op::ADD: alu_rr(E::ADD, true); break;
+				case Op::SUB: alu_rr(E::SUB, true); break;
+				case Op::SLL: shift_rr(E::SHL, true); break;
+				case Op::SLT: set_rr(E::L); break;
+				case Op::SLTU: set_rr(E::B); break;
+				case Op::XOR: alu_rr(E::XOR, true); break;
+				case Op::SRL: shift_rr(E::SHR, true); break;
+				case Op::SRA: shift_rr(E::SAR, true); break;
+				case Op::OR: alu_rr(E::OR, true); break;
+				case Op::AND: alu_rr(E::AND, true); break;
+				case Op::MUL:
+					get_to(d.rs1, E::rax);
+					a.imul(E::rax, get(d.rs2, E::rcx));
+					set(d.rd, E::rax);
+					break;
+				case Op::MULH: mul_hi(true, false); break;
+				case Op::MULHSU: mul_hi(false, true); break;
+				case Op::MULHU: mul_hi(false, false); break;
+				case Op::ADDW: alu_rr(E::ADD, false); break;
+				case Op::SUBW: alu_rr(E::SUB, false); break;
+				case Op::SLLW: shift_rr(E::SHL, false); break;
+				case Op::SRLW: shift_rr(E::SHR, false); break;
+				case Op::SRAW: shift_rr(E::SAR, false); break;
+				case Op::MULW:
+					get_to(d.rs1, E::rax);
+					a.imul(E::rax, get(d.rs2, E::rcx), false);
+					a.movsxd(E::rax, E::rax);
+					set(d.rd, E::rax);
+					break;
+				case Op::DIV: case Op::DIVU: case Op::REM: case Op::REMU:
+				case Op::DIVW: case Op::DIVUW: case Op::REMW: case Op::REMUW:
+					div();
+					break;
+				default: break; // NOP
+			}
+		}
 
-			if(pc == sentinel_pc) [[unlikely]]
-				halted = true;
+		// Fall out of the block: either through its terminator, or to the unsupported op that follows
+		if (k < blk.len)
+		{
+			a.mov_imm(E::rax, op_addr(blk.first + k));
+			a.store(E::rbx, ctx_pc, E::rax);
+			a.mov_imm(E::rax, k | jit_interp);
+		}
+		else
+		{
+			if (!ends_block(base_op(ops[k-1].op)))
+			{
+				a.mov_imm(E::rax, op_addr(blk.first + k));
+				a.store(E::rbx, ctx_pc, E::rax);
+			}
+			a.mov_imm(E::rax, k);
+		}
+
+		const size_t epilogue = a.pos();
+		for (u8 r = 1; r < 32; ++r)
+			if (host_of[r] >= 0)
+				a.store(E::r12, r*8, host_regs[host_of[r]]);
+		a.alu_imm(E::ADD, E::rsp, 8);
+		a.pop(E::r15); a.pop(E::r14); a.pop(E::r13); a.pop(E::r12); a.pop(E::rbp); a.pop(E::rbx);
+		a.ret();
+
+		for (const auto& exit : exits)
+		{
+			a.bind(exit.fixup);
+			a.mov_imm(E::rax, exit.pc);
+			a.store(E::rbx, ctx_pc, E::rax);
+			a.mov_imm(E::rax, exit.ret);
+			a.bind(a.jmp(), epilogue);
 		}
+
+		a.writable(false);
+		return reinterpret_cast<JitFn>(const_cast<u8*>(a.at(start)));
 	}
+#endif
 
-	// Halt the program (if it's running)
-	//   This is the only thread safe call - everything else should be called synchronously
-	bool halt_program()
+	// Build (or drop) the decoded form of the program to suit the selected engine
+	void predecode_program()
 	{
-		auto alreadyHalted = halted.exchange(true);
-		return !alreadyHalted;
+		decoded_own = {};
+		if (engine == Engine::Interpreter)
+		{
+			decoded = {};
+			decoded_end = 0;
+		}
+		else if (shared_end != p_beg) // the image's ops, never written since stores to them are refused
+		{
+			decoded = {const_cast<DecodedOp*>(image->decoded.data()), image->decoded.size()};
+			decoded_end = shared_end;
+		}
+		else
+		{
+			decoded_own.resize(program_bytes() / 4);
+			decoded = decoded_own;
+			for (size_t i = 0; i < decoded.size(); ++i)
+				decoded[i] = decode_at(op_addr(i));
+			fuse_decoded(decoded);
+			decoded_end = op_addr(decoded.size());
+		}
+		flush_blocks();
 	}
 
-	virtual void reset()
+	// Index in decoded of the op at (word aligned, in range) addr, and back
+	TINYRISCV64_INLINE size_t op_index(const u64 addr) const { return (addr - p_beg) >> 2; }
+	u64 op_addr(const size_t index) const { return p_beg + index * 4; }
+
+	// Mark decoded ops overlapping a write to program memory for re-decode
+	//   along with fused ops that cover them
+	inline void invalidate_decoded(const u64 addr, const size_t len)
 	{
-		for(auto& xn : x) xn=0;
-		//x1 - return address (ra)
-		x[1] = (program.size() + 3) & ~3ull;
-		//x2 - stack pointer (sp)
-		x[2] = program.size()+64+data.size()+64+stack.size();
-		//x8 - frame pointer (s0 / fp)
-		x[8] = x[2];
+		const u64 first = op_index(addr);
+		const u64 last = std::min<u64>(op_index(addr + len - 1), decoded.size() - 1);
+		for (u64 i = first - std::min<u64>(first, 2); i <= last; ++i)
+		{
+			if (i < first && i + op_width(decoded[i].op) <= first)
+				continue;
+			decoded[i].op = Op::DECODE;
+			if (i >= blocks_lo && i < blocks_hi)
+				blocks_stale = true;
+		}
+	}
 
-		p_end = program.size();
-		/* 64 overflow detection addresses */
-		d_beg = program.size()+64;
-		d_end = program.size()+64+data.size();
-		/* 64 overflow detection addresses */
-		s_beg = program.size()+64+data.size()+64;
-		s_end = program.size()+64+data.size()+64+stack.size();
+	// Fuse common idioms into single ops, to cut dispatches
+	//   each fused op runs its parts exactly as if they were dispatched one by one, and the
+	//   slots it covers keep their own decode, so jumps into the middle of an idiom still work
+	static void fuse_decoded(const std::span<DecodedOp> decoded)
+	{
+		const size_t n = decoded.size();
+		for (size_t i = 0; i + 1 < n; ++i)
+		{
+			DecodedOp& a = decoded[i];
+			const DecodedOp& b = decoded[i+1];
+			if (a.op == Op::LI && b.rs1 == a.rd)
+			{
+				if (b.op == Op::ADDI) a.op = Op::LI_ADDI;
+				else if (b.op == Op::ADDIW) a.op = Op::LI_ADDIW;
+				else if (b.op == Op::JALR) a.op = Op::LI_JALR;
+			}
+			else if (a.op == Op::ADDI && a.rd == a.rs1 && b.op == Op::BNE && (b.rs1 == a.rd || b.rs2 == a.rd))
+				a.op = Op::ADDI_BNE;
+			else if ((a.op == Op::SLLI && b.op == Op::SRLI) || (a.op == Op::SRLI && b.op == Op::SLLI))
+			{
+				const bool sll = a.op == Op::SLLI;
+				if (b.rs1 == a.rs1 && a.rd != a.rs1)
+				{
+					// Both halves of a rotate, usually combined next
+					a.op = sll ? Op::SLLI_SRLI : Op::SRLI_SLLI;
+					if (i + 2 < n)
+					{
+						const DecodedOp& c = decoded[i+2];
+						if ((c.rs1 == a.rd && c.rs2 == b.rd) || (c.rs1 == b.rd && c.rs2 == a.rd))
+						{
+							if (c.op == Op::OR) a.op = sll ? Op::SLLI_SRLI_OR : Op::SRLI_SLLI_OR;
+							else if (c.op == Op::ADD) a.op = sll ? Op::SLLI_SRLI_ADD : Op::SRLI_SLLI_ADD;
+							else if (c.op == Op::XOR) a.op = sll ? Op::SLLI_SRLI_XOR : Op::SRLI_SLLI_XOR;
+						}
+					}
+				}
+				else if (b.rs1 == a.rd)
+					a.op = sll ? Op::SLLI_SRLI : Op::SRLI_SLLI;
+			}
+		}
 	}
 
-protected:
+	inline u32 fetch(const u64 addr) const
+	{
+		if (mem_path == Memory::Paged) // needs Perm::X
+			return pages->fetch(addr);
+		u32 word;
+		memcpy(&word, addr < shared_end ? shared_mem + (addr - p_beg) : prog_mem + (addr - shared_end), 4);
+		return word;
+	}
 
-	// Load program from file
-	static std::vector<u8> load_program(const std::string& filename, const size_t max_size)
+	// Decode the instruction at addr; with Memory::Paged one that can't be fetched is left as DECODE,
+	//   so the fault is reported if it runs (see decode_in_code() for the others left as DECODE)
+	DecodedOp decode_at(const u64 addr) const
 	{
-		std::ifstream fin(filename, std::ios::binary | std::ios::ate);
-		if (!fin)
-			throw std::invalid_argument("Failed to open program file: " + filename);
+		if (mem_path == Memory::Paged && !pages->allows(addr, 4, Perm::X))
+			return {Op::DECODE, 0, 0, 0, 0, 0};
+		return decode_in_code(fetch(addr), addr, p_beg, code_end(), halt_pc());
+	}
 
-		size_t size = fin.tellg();
-		if (size > max_size)
-			throw std::invalid_argument(std::format("Program too large (max {})", max_size));
+	// Whether a whole, word aligned instruction can be fetched from addr in the code [beg, end)
+	static bool in_code(const u64 addr, const u64 beg, const u64 end)
+	{
+		return !(addr & 3) && addr - beg < ((end - beg) & ~3ull);
+	}
 
-		fin.seekg(0, std::ios::beg);
-		std::vector<u8> prog(size);
-		fin.read(reinterpret_cast<char*>(prog.data()), size);
-		return prog;
+	// Whether the pc can go on to addr from the code [beg, end): an instruction there, or the halt pc
+	static bool continues_to(const u64 addr, const u64 beg, const u64 end, const u64 halt)
+	{
+		return addr == halt || in_code(addr, beg, end);
 	}
 
-	// Instruction Decoding
-	inline u8 opcode() const { return inst & 0x7f; }
-	inline u8 funct3() const { return (inst >> 12) & 0x7; }
-	inline u8 funct7() const { return (inst >> 25) & 0x7f; }
-	inline u8 rd() const { return (inst >> 7) & 0x1f; }
-	inline u8 rs1() const { return (inst >> 15) & 0x1f; }
-	inline u8 rs2() const { return (inst >> 20) & 0x1f; }
-	inline i64 imm_i() const { return static_cast<i64>(static_cast<i32>(inst) >> 20); }
-	inline i64 imm_s() const { return (imm_i() & ~0x1fLL) | rd(); }
-	inline i64 imm_b() const {
-	    return (static_cast<i64>(static_cast<i32>(inst & 0x80000000)) >> 19) |
-		     ((inst & 0x80) << 4) | ((inst >> 20) & 0x7e0) | ((inst >> 7) & 0x1e);
+	// Decode an instruction word located at addr in the code [beg, end), which halts at halt, for the decoded-op
+	//   engines: one that could leave the code other than as checks_pc() says (a branch or JAL out of it, or an
+	//   instruction falling off its end short of halt) is left as DECODE, so the pc is checked after it runs
+	static DecodedOp decode_in_code(const u32 word, const u64 addr, const u64 beg, const u64 end, const u64 halt)
+	{
+		DecodedOp d = decode(word, addr);
+		bool stays = true;
+		if (d.op == Op::JAL || (d.op >= Op::BEQ && d.op <= Op::BGEU))
+			stays = continues_to(d.imm, beg, end, halt);
+		if (d.op != Op::JAL && d.op != Op::JALR && d.op != Op::INTERP)
+			stays = stays && continues_to(addr + 4, beg, end, halt);
+		if (!stays)
+			d.op = Op::DECODE;
+		return d;
+	}
+
+	// Whether a SYSTEM instruction is one dispatch_instruction() knows (the CSR ones, and exec_system()'s)
+	static bool known_system(const u32 word)
+	{
+		if (opcode(word) != 0x73)
+			return false;
+		switch (word)
+		{
+			case 0x00000073: // ECALL
+			case 0x00100073: // EBREAK
+			case 0x10500073: // WFI
+			case 0x30200073: // MRET
+			case 0x10200073: // SRET
+			case 0x00200073: // URET
+				return true;
+			default:
+				return funct3(word) != 0;
+		}
+	}
+
+	// Verify the code in [base, base+code.size()), which halts at halt, reachable from entry, from symbols'
+	//   functions and from roots (see VerifiedCode)
+	//   every instruction reached must decode (or be a known SYSTEM one), and every direct branch or JAL target
+	//   and fall-through from it must be a word of the code or halt; a call's return point (and the instruction
+	//   after a SYSTEM one) is only followed speculatively, up to the first instruction that breaks this, since
+	//   the call might never return
+	//   every function symbol in the code is a root like the entry point, so an invalid word in a function
+	//   nothing calls still refuses the whole program: a symbol table vouches for all the functions it names
+	//   an entry of base_entry stands for none; throws std::invalid_argument naming the first bad instruction
+	static std::shared_ptr<const VerifiedCode> verify_code(const std::span<const u8> code, const u64 base, const u64 halt,
+		const u64 entry, const Symbols& symbols = Symbols(), const std::span<const u64> roots = {})
+	{
+		const u64 end = base + code.size();
+		auto verified = std::make_shared<VerifiedCode>();
+		verified->base = base;
+		verified->reached.resize(code.size() / 4);
+
+		// Paths that must be good are taken first, so only what nothing else reaches is taken speculatively
+		std::vector<u64> pending, speculative, leaders;
+		const auto reach = [&](const u64 addr, const bool must, const bool leader)
+		{
+			if (leader)
+				leaders.push_back(addr);
+			const size_t i = (addr - base) / 4;
+			if (!must)
+				speculative.push_back(addr);
+			else if (!verified->reached[i])
+			{
+				verified->reached[i] = true;
+				pending.push_back(addr);
+			}
+		};
+		if (entry != base_entry)
+			verified->roots.push_back(entry);
+		for (const auto& symbol : symbols.all())
+			if (symbol.kind == Symbols::Kind::Function && in_code(symbol.addr, base, end))
+				verified->roots.push_back(symbol.addr);
+		verified->roots.insert(verified->roots.end(), roots.begin(), roots.end());
+		for (const u64 root : verified->roots)
+		{
+			if (!in_code(root, base, end))
+				throw std::invalid_argument(std::format("Entry point 0x{:x} is outside the program code", root));
+			reach(root, true, true);
+		}
+
+		std::vector<u64> jalrs;
+		while (!pending.empty() || !speculative.empty())
+		{
+			const bool must = !pending.empty();
+			auto& from = must ? pending : speculative;
+			const u64 addr = from.back();
+			from.pop_back();
+			if (!must && verified->reached[(addr - base) / 4])
+				continue;
+			u32 word;
+			std::memcpy(&word, code.data() + (addr - base), 4);
+			const DecodedOp d = decode(word, addr);
+
+			// What's wrong with the instruction, if anything
+			const bool direct = d.op == Op::JAL || (d.op >= Op::BEQ && d.op <= Op::BGEU);
+			const bool falls = d.op != Op::JAL && d.op != Op::JALR && d.op != Op::INTERP;
+			std::string bad;
+			if (d.op == Op::INTERP && !known_system(word))
+				bad = std::format("Invalid instruction 0x{:08x} at {}", word, symbols.describe(addr));
+			else if (direct && !continues_to(d.imm, base, end, halt))
+				bad = std::format("Instruction at {} jumps to 0x{:x}, outside the program code",
+					symbols.describe(addr), static_cast<u64>(d.imm));
+			else if (falls && !continues_to(addr + 4, base, end, halt))
+				bad = std::format("Instruction at {} runs off the end of the program code", symbols.describe(addr));
+			if (!bad.empty())
+			{
+				if (must)
+					throw std::invalid_argument(bad);
+				continue;
+			}
+			verified->reached[(addr - base) / 4] = true;
+
+			if (d.op == Op::JALR)
+				jalrs.push_back(addr);
+			if (direct && static_cast<u64>(d.imm) != halt)
+				reach(d.imm, must, true);
+			const bool next = in_code(addr + 4, base, end);
+			if (falls && next)
+				reach(addr + 4, must, ends_block(d.op));
+			else if (next && (d.op == Op::INTERP || (d.op == Op::JAL && d.rd != 0)))
+				reach(addr + 4, false, true);
+		}
+
+		// Each indirect jump ends the block starting at the nearest leader before it
+		std::sort(leaders.begin(), leaders.end());
+		for (const u64 addr : jalrs)
+			verified->indirect.push_back(*std::prev(std::upper_bound(leaders.begin(), leaders.end(), addr)));
+		std::sort(verified->indirect.begin(), verified->indirect.end());
+		verified->indirect.erase(std::unique(verified->indirect.begin(), verified->indirect.end()), verified->indirect.end());
+		return verified;
 	}
-	inline i64 imm_j() const {
-	    return (static_cast<i64>(static_cast<i32>(inst & 0x80000000)) >> 11) |
-		     (inst & 0xff000) | ((inst >> 9) & 0x800) | ((inst >> 20) & 0x7fe);
+
+	// Decode an instruction word located at addr into a DecodedOp
+	//   encodings without a dedicated op (SYSTEM, illegal) decode to INTERP,
+	//   which executes the raw word so faults are reported exactly as before
+	static DecodedOp decode(const u32 word, const u64 addr)
+	{
+		DecodedOp op{Op::INTERP, rd(word), rs1(word), rs2(word), word, 0};
+		const u8 f3 = funct3(word);
+		const auto alu_op = funct7(word) << 3 | f3;
+
+		switch(opcode(word))
+		{
+			case 0x37: op.op = Op::LI; op.imm = static_cast<i64>(imm_u(word)); break;            // LUI
+			case 0x17: op.op = Op::LI; op.imm = static_cast<i64>(addr + imm_u(word)); break;     // AUIPC
+			case 0x6f: op.op = Op::JAL; op.imm = static_cast<i64>(addr + imm_j(word)); break;    // JAL
+			case 0x67: op.op = Op::JALR; op.imm = imm_i(word); break;                            // JALR
+			case 0x63:                                                                         // Branch
+			{
+				constexpr Op ops[8] = {Op::BEQ, Op::BNE, Op::INTERP, Op::INTERP, Op::BLT, Op::BGE, Op::BLTU, Op::BGEU};
+				op.op = ops[f3];
+				op.imm = static_cast<i64>(addr + imm_b(word));
+				break;
+			}
+			case 0x03:                                                                         // Load
+			{
+				constexpr Op ops[8] = {Op::LB, Op::LH, Op::LW, Op::LD, Op::LBU, Op::LHU, Op::LWU, Op::INTERP};
+				op.op = ops[f3];
+				op.imm = imm_i(word);
+				break;
+			}
+			case 0x23:                                                                         // Store
+			{
+				constexpr Op ops[8] = {Op::SB, Op::SH, Op::SW, Op::SD, Op::INTERP, Op::INTERP, Op::INTERP, Op::INTERP};
+				op.op = ops[f3];
+				op.imm = imm_s(word);
+				break;
+			}
+			case 0x13:                                                                         // ALU immediate
+			{
+				constexpr Op ops[8] = {Op::ADDI, Op::SLLI, Op::SLTI, Op::SLTIU, Op::XORI, Op::SRLI, Op::ORI, Op::ANDI};
+				op.op = ops[f3];
+				op.imm = imm_i(word);
+				if (f3 == 1 || f3 == 5)
+				{
+					if (f3 == 5 && (op.imm & 0x400))
+						op.op = Op::SRAI;
+					op.imm &= 0x3f;
+				}
+				break;
+			}
+			case 0x1b:                                                                         // ALU immediate 32-bit
+			{
+				constexpr Op ops[8] = {Op::ADDIW, Op::SLLIW, Op::INTERP, Op::INTERP, Op::INTERP, Op::SRLIW, Op::INTERP, Op::INTERP};
+				op.op = ops[f3];
+				op.imm = imm_i(word);
+				if (f3 == 1 || f3 == 5)
+				{
+					if (f3 == 5 && (op.imm & 0x400))
+						op.op = Op::SRAIW;
+					op.imm &= 0x1f;
+				}
+				break;
+			}
+			case 0x33:                                                                         // ALU register
+				switch(alu_op)
+				{
+					case 0x000: op.op = Op::ADD; break;
+					case 0x100: op.op = Op::SUB; break;
+					case 0x001: op.op = Op::SLL; break;
+					case 0x002: op.op = Op::SLT; break;
+					case 0x003: op.op = Op::SLTU; break;
+					case 0x004: op.op = Op::XOR; break;
+					case 0x005: op.op = Op::SRL; break;
+					case 0x105: op.op = Op::SRA; break;
+					case 0x006: op.op = Op::OR; break;
+					case 0x007: op.op = Op::AND; break;
+					case 0x008: op.op = Op::MUL; break;
+					case 0x009: op.op = Op::MULH; break;
+					case 0x00a: op.op = Op::MULHSU; break;
+					case 0x00b: op.op = Op::MULHU; break;
+					case 0x00c: op.op = Op::DIV; break;
+					case 0x00d: op.op = Op::DIVU; break;
+					case 0x00e: op.op = Op::REM; break;
+					case 0x00f: op.op = Op::REMU; break;
+					default: break;
+				}
+				break;
+			case 0x3b:                                                                         // ALU register 32-bit
+				switch(alu_op)
+				{
+					case 0x000: op.op = Op::ADDW; break;
+					case 0x100: op.op = Op::SUBW; break;
+					case 0x001: op.op = Op::SLLW; break;
+					case 0x005: op.op = Op::SRLW; break;
+					case 0x105: op.op = Op::SRAW; break;
+					case 0x008: op.op = Op::MULW; break;
+					case 0x00c: op.op = Op::DIVW; break;
+					case 0x00d: op.op = Op::DIVUW; break;
+					case 0x00e: op.op = Op::REMW; break;
+					case 0x00f: op.op = Op::REMUW; break;
+					default: break;
+				}
+				break;
+			case 0x0f: op.op = Op::NOP; break;                                                 // FENCE (nop)
+			default: break;                                                                    // SYSTEM or unknown
+		}
+		return op;
 	}
-	inline u64 imm_u() const { return static_cast<u64>(static_cast<i64>(static_cast<i32>(inst & 0xfffff000))); }
 
+	// Instruction Decoding
+	static inline u8 opcode(const u32 i) { return i & 0x7f; }
+	static inline u8 funct3(const u32 i) { return (i >> 12) & 0x7; }
+	static inline u8 funct7(const u32 i) { return (i >> 25) & 0x7f; }
+	static inline u8 rd(const u32 i) { return (i >> 7) & 0x1f; }
+	static inline u8 rs1(const u32 i) { return (i >> 15) & 0x1f; }
+	static inline u8 rs2(const u32 i) { return (i >> 20) & 0x1f; }
+	static inline i64 imm_i(const u32 i) { return static_cast<i64>(static_cast<i32>(i) >> 20); }
+	static inline i64 imm_s(const u32 i) { return (imm_i(i) & ~0x1fLL) | rd(i); }
+	static inline i64 imm_b(const u32 i) {
+	    return (static_cast<i64>(static_cast<i32>(i & 0x80000000)) >> 19) |
+		     ((i & 0x80) << 4) | ((i >> 20) & 0x7e0) | ((i >> 7) & 0x1e);
+	}
+	static inline i64 imm_j(const u32 i) {
+	    return (static_cast<i64>(static_cast<i32>(i & 0x80000000)) >> 11) |
+		     (i & 0xff000) | ((i >> 9) & 0x800) | ((i >> 20) & 0x7fe);
+	}
+	static inline u64 imm_u(const u32 i) { return static_cast<u64>(static_cast<i64>(static_cast<i32>(i & 0xfffff000))); }
+
+	// Current instruction fields
+	inline u8 opcode() const { return opcode(inst); }
+	inline u8 funct3() const { return funct3(inst); }
+	inline u8 funct7() const { return funct7(inst); }
+	inline u8 rd() const { return rd(inst); }
+	inline u8 rs1() const { return rs1(inst); }
+	inline u8 rs2() const { return rs2(inst); }
+	inline i64 imm_i() const { return imm_i(inst); }
+	inline i64 imm_s() const { return imm_s(inst); }
+	inline i64 imm_b() const { return imm_b(inst); }
+	inline i64 imm_j() const { return imm_j(inst); }
+	inline u64 imm_u() const { return imm_u(inst); }
 
 	inline void execute_instruction()
 	{
-		memcpy(&inst,&program[pc],4);
+		inst = fetch(pc);
 		pc += 4;
+		dispatch_instruction();
+	}
 
-		// Execute
+	// Execute the current instruction (inst), pc already points past it
+	inline void dispatch_instruction()
+	{
 		x[0] = 0; // Ensure x0 stays zero
 
 		switch(opcode())
@@ -278,37 +3485,253 @@ protected:
 		}
 	}
 
-	// Memory access helpers
+	TINYRISCV64_INLINE void execute_decoded(const DecodedOp& d)
+	{
+		switch(d.op)
+		{
+			#define TINYRISCV64_OP_CASE(name) case Op::name: exec_op<Op::name>(d); break;
+			TINYRISCV64_OPS(TINYRISCV64_OP_CASE)
+			#undef TINYRISCV64_OP_CASE
+		}
+	}
+
+	// Execute one decoded op; pc must be the (word aligned) address it was decoded from
+	template<Op O>
+	TINYRISCV64_INLINE void exec_op(const DecodedOp& d)
+	{
+		if constexpr (O == Op::DECODE) // program memory was written since decode, or the op could leave the code
+		{
+			inst = fetch(pc);
+			const DecodedOp op = decode_in_code(inst, pc, p_beg, code_end(), halt_pc());
+			if (op.op != Op::DECODE)
+				decoded[op_index(pc)] = op;
+			pc += 4;
+			dispatch_instruction();
+			return;
+		}
+		else if constexpr (O == Op::INTERP)
+		{
+			inst = d.inst;
+			pc += 4;
+			dispatch_instruction();
+			return;
+		}
+		else if constexpr (is_fused(O))
+		{
+			constexpr auto parts = fused_parts(O);
+			exec_op<parts.part[0]>(d);
+			exec_op<parts.part[1]>((&d)[1]);
+			if constexpr (parts.width == 3)
+				exec_op<parts.part[2]>((&d)[2]);
+			return;
+		}
+
+		pc += 4;
+		x[0] = 0; // Ensure x0 stays zero
+
+		if constexpr (O == Op::LI) x[d.rd] = d.imm;         // LUI, AUIPC
+		else if constexpr (O == Op::JAL) { x[d.rd] = pc; pc = d.imm; }
+		else if constexpr (O == Op::JALR)
+		{
+			const u64 target = (x[d.rs1] + d.imm) & ~1ULL;
+			x[d.rd] = pc;
+			pc = target;
+		}
+		else if constexpr (O == Op::BEQ) { if (x[d.rs1] == x[d.rs2]) pc = d.imm; }
+		else if constexpr (O == Op::BNE) { if (x[d.rs1] != x[d.rs2]) pc = d.imm; }
+		else if constexpr (O == Op::BLT) { if (static_cast<i64>(x[d.rs1]) < static_cast<i64>(x[d.rs2])) pc = d.imm; }
+		else if constexpr (O == Op::BGE) { if (static_cast<i64>(x[d.rs1]) >= static_cast<i64>(x[d.rs2])) pc = d.imm; }
+		else if constexpr (O == Op::BLTU) { if (x[d.rs1] < x[d.rs2]) pc = d.imm; }
+		else if constexpr (O == Op::BGEU) { if (x[d.rs1] >= x[d.rs2]) pc = d.imm; }
+		else if constexpr (O == Op::LB) x[d.rd] = static_cast<i64>(mem_load<i8>(x[d.rs1] + d.imm));
+		else if constexpr (O == Op::LH) x[d.rd] = static_cast<i64>(mem_load<i16>(x[d.rs1] + d.imm));
+		else if constexpr (O == Op::LW) x[d.rd] = static_cast<i64>(mem_load<i32>(x[d.rs1] + d.imm));
+		else if constexpr (O == Op::LD) x[d.rd] = mem_load<u64>(x[d.rs1] + d.imm);
+		else if constexpr (O == Op::LBU) x[d.rd] = mem_load<u8>(x[d.rs1] + d.imm);
+		else if constexpr (O == Op::LHU) x[d.rd] = mem_load<u16>(x[d.rs1] + d.imm);
+		else if constexpr (O == Op::LWU) x[d.rd] = mem_load<u32>(x[d.rs1] + d.imm);
+		else if constexpr (O == Op::SB) mem_store<u8>(x[d.rs1] + d.imm, x[d.rs2]);
+		else if constexpr (O == Op::SH) mem_store<u16>(x[d.rs1] + d.imm, x[d.rs2]);
+		else if constexpr (O == Op::SW) mem_store<u32>(x[d.rs1] + d.imm, x[d.rs2]);
+		else if constexpr (O == Op::SD) mem_store<u64>(x[d.rs1] + d.imm, x[d.rs2]);
+		else if constexpr (O == Op::ADDI) x[d.rd] = x[d.rs1] + d.imm;
+		else if constexpr (O == Op::SLLI) x[d.rd] = x[d.rs1] << d.imm;
+		else if constexpr (O == Op::SLTI) x[d.rd] = static_cast<i64>(x[d.rs1]) < d.imm;
+		else if constexpr (O == Op::SLTIU) x[d.rd] = x[d.rs1] < static_cast<u64>(d.imm);
+		else if constexpr (O == Op::XORI) x[d.rd] = x[d.rs1] ^ d.imm;
+		else if constexpr (O == Op::SRLI) x[d.rd] = x[d.rs1] >> d.imm;
+		else if constexpr (O == Op::SRAI) x[d.rd] = static_cast<u64>(static_cast<i64>(x[d.rs1]) >> d.imm);
+		else if constexpr (O == Op::ORI) x[d.rd] = x[d.rs1] | d.imm;
+		else if constexpr (O == Op::ANDI) x[d.rd] = x[d.rs1] & d.imm;
+		else if constexpr (O == Op::ADDIW) x[d.rd] = static_cast<i64>(static_cast<i32>(static_cast<u32>(x[d.rs1]) + static_cast<u32>(d.imm)));
+		else if constexpr (O == Op::SLLIW) x[d.rd] = static_cast<i64>(static_cast<i32>(static_cast<u32>(x[d.rs1]) << d.imm));
+		else if constexpr (O == Op::SRLIW) x[d.rd] = static_cast<i64>(static_cast<i32>(static_cast<u32>(x[d.rs1]) >> d.imm));
+		else if constexpr (O == Op::SRAIW) x[d.rd] = static_cast<i64>(static_cast<i32>(x[d.rs1]) >> d.imm);
+		else if constexpr (O == Op::ADD) x[d.rd] = x[d.rs1] + x[d.rs2];
+		else if constexpr (O == Op::SUB) x[d.rd] = x[d.rs1] - x[d.rs2];
+		else if constexpr (O == Op::SLL) x[d.rd] = x[d.rs1] << (x[d.rs2] & 0x3f);
+		else if constexpr (O == Op::SLT) x[d.rd] = static_cast<i64>(x[d.rs1]) < static_cast<i64>(x[d.rs2]);
+		else if constexpr (O == Op::SLTU) x[d.rd] = x[d.rs1] < x[d.rs2];
+		else if constexpr (O == Op::XOR) x[d.rd] = x[d.rs1] ^ x[d.rs2];
+		else if constexpr (O == Op::SRL) x[d.rd] = x[d.rs1] >> (x[d.rs2] & 0x3f);
+		else if constexpr (O == Op::SRA) x[d.rd] = static_cast<u64>(static_cast<i64>(x[d.rs1]) >> (x[d.rs2] & 0x3f));
+		else if constexpr (O == Op::OR) x[d.rd] = x[d.rs1] | x[d.rs2];
+		else if constexpr (O == Op::AND) x[d.rd] = x[d.rs1] & x[d.rs2];
+		else if constexpr (O == Op::MUL) x[d.rd] = x[d.rs1] * x[d.rs2];
+		else if constexpr (O == Op::MULH) x[d.rd] = mulh(x[d.rs1],x[d.rs2]);
+		else if constexpr (O == Op::MULHSU) x[d.rd] = mulhsu(x[d.rs1],x[d.rs2]);
+		else if constexpr (O == Op::MULHU) x[d.rd] = mulhu(x[d.rs1],x[d.rs2]);
+		else if constexpr (O == Op::DIV) exec_alu_reg(4, 1, d.rd, d.rs1, d.rs2);
+		else if constexpr (O == Op::DIVU) exec_alu_reg(5, 1, d.rd, d.rs1, d.rs2);
+		else if constexpr (O == Op::REM) exec_alu_reg(6, 1, d.rd, d.rs1, d.rs2);
+		else if constexpr (O == Op::REMU) exec_alu_reg(7, 1, d.rd, d.rs1, d.rs2);
+		else if constexpr (O == Op::ADDW) x[d.rd] = static_cast<i64>(static_cast<i32>(static_cast<u32>(x[d.rs1]) + static_cast<u32>(x[d.rs2])));
+		else if constexpr (O == Op::SUBW) x[d.rd] = static_cast<i64>(static_cast<i32>(static_cast<u32>(x[d.rs1]) - static_cast<u32>(x[d.rs2])));
+		else if constexpr (O == Op::SLLW) x[d.rd] = static_cast<i64>(static_cast<i32>(static_cast<u32>(x[d.rs1]) << (x[d.rs2] & 0x1f)));
+		else if constexpr (O == Op::SRLW) x[d.rd] = static_cast<i64>(static_cast<i32>(static_cast<u32>(x[d.rs1]) >> (x[d.rs2] & 0x1f)));
+		else if constexpr (O == Op::SRAW) x[d.rd] = static_cast<i64>(static_cast<i32>(x[d.rs1]) >> (x[d.rs2] & 0x1f));
+		else if constexpr (O == Op::MULW) x[d.rd] = static_cast<i64>(static_cast<i32>(static_cast<u32>(x[d.rs1]) * static_cast<u32>(x[d.rs2])));
+		else if constexpr (O == Op::DIVW) exec_alu_reg32(4, 1, d.rd, d.rs1, d.rs2);
+		else if constexpr (O == Op::DIVUW) exec_alu_reg32(5, 1, d.rd, d.rs1, d.rs2);
+		else if constexpr (O == Op::REMW) exec_alu_reg32(6, 1, d.rd, d.rs1, d.rs2);
+		else if constexpr (O == Op::REMUW) exec_alu_reg32(7, 1, d.rd, d.rs1, d.rs2);
+		else if constexpr (O == Op::NOP) {}                  // FENCE
+	}
+
+	// call() argument marshalling: an integer or enum as its register (or stack) word
 	template<typename T>
-	inline u8* mem_ptr(u64 addr)
+	u64 call_arg(const T& arg, u64&, std::vector<std::pair<u64, std::span<u8>>>&)
+	{
+		static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "call() passes integers, enums and spans");
+		if constexpr (std::is_enum_v<T>)
+			return call_word(static_cast<std::underlying_type_t<T>>(arg));
+		else
+			return call_word(arg);
+	}
+	template<typename T>
+	static u64 call_word(const T arg)
+	{
+		if constexpr (sizeof(T) == 4) // 32 bit values are sign-extended, unsigned ones too
+			return static_cast<u64>(static_cast<i64>(static_cast<i32>(arg)));
+		else if constexpr (std::is_signed_v<T>)
+			return static_cast<u64>(static_cast<i64>(arg));
+		else
+			return static_cast<u64>(arg);
+	}
+
+	// A span as the address of its bytes, copied onto the stack below sp
+	template<typename T, size_t N>
+	u64 call_arg(const std::span<T, N>& arg, u64& sp, std::vector<std::pair<u64, std::span<u8>>>& copy_back)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "call() copies spans of trivially copyable values");
+		const auto bytes = std::as_bytes(arg);
+		sp = call_alloc(sp, bytes.size());
+		for (size_t i = 0; i < bytes.size(); ++i)
+			mem_store<u8>(sp + i, static_cast<u8>(bytes[i]));
+		if constexpr (!std::is_const_v<T>)
+			copy_back.emplace_back(sp, std::span<u8>(reinterpret_cast<u8*>(arg.data()), arg.size_bytes()));
+		return sp;
+	}
+
+	// Make room for size bytes on the stack below sp, keeping it 16 byte aligned
+	u64 call_alloc(const u64 sp, const size_t size) const
+	{
+		if (size > sp - s_beg || ((sp - size) & ~15ull) < s_beg)
+			throw std::invalid_argument(std::format("Call arguments overflow the stack ({} bytes)", size));
+		return (sp - size) & ~15ull;
+	}
+
+	// Memory access helpers
+	template<typename T, bool Store = false>
+	TINYRISCV64_INLINE u8* mem_ptr(u64 addr)
 	{
+		if (mem_path == Memory::Flat) // one compare covers the arena from p_beg, a second finds the data band
+		{
+			if (addr - p_beg > s_end - p_beg - sizeof(T)) [[unlikely]]
+				throw std::runtime_error("Memory access out of bounds");
+			// [p_end, s_beg) holds the gaps and the data regions, which stay in their own buffers
+			if (addr + (sizeof(T) - 1) - p_end < s_beg - p_end + (sizeof(T) - 1))
+			{
+				if (addr >= d_beg && addr + sizeof(T) <= d_end)
+					return data_ptr<Store>(addr, addr + sizeof(T) - 1);
+				[[unlikely]] throw std::runtime_error("Memory access out of bounds");
+			}
+			return arena_mem + addr;
+		}
+		#if defined(TINYRISCV64_GUARD)
+		if (mem_path == Memory::Guarded) // a stray access within 4 GiB faults (see GuardedArena)
+		{
+			if (addr - d_beg < d_end - d_beg) // the data regions stay in their own buffers
+			{
+				if (addr + sizeof(T) > d_end) [[unlikely]]
+					throw std::runtime_error("Memory access out of bounds");
+				return data_ptr<Store>(addr, addr + sizeof(T) - 1);
+			}
+			if (addr >> 32) [[unlikely]]
+				throw std::runtime_error("Memory access out of bounds");
+			// The fault handler sees pc, the registers and the counts as they are stored here
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+			return arena_mem + addr;
+		}
+		#endif
+
 		if (addr > 0xFFFFFFFFFFFFFFF0ULL) [[unlikely]] //guard against wrap-around
 			throw std::runtime_error("Memory access out of bounds");
 
 		const u64 addr_max = addr + sizeof(T) - 1;
 
 		if(addr_max < p_end)
-			return program.data() + addr;
+		{
+			if (addr >= shared_end) [[likely]]
+				return prog_mem + (addr - shared_end);
+			if (addr_max >= shared_end || addr < p_beg) [[unlikely]]
+				throw std::runtime_error("Memory access out of bounds");
+			return const_cast<u8*>(shared_mem) + (addr - p_beg); // loads only (see mem_store())
+		}
 		if(addr >= d_beg && addr_max < d_end)
-			return data.data() + addr - d_beg;
+			return data_ptr<Store>(addr, addr_max);
 		if(addr >= s_beg && addr_max < s_end)
-			return stack.data() + addr - s_beg;
+			return stack_mem + addr - s_beg;
 
 		[[unlikely]] throw std::runtime_error("Memory access out of bounds");
 	}
 
+	// Resolve an access within [d_beg, d_end), which may fall in a gap between data regions
+	template<bool Store>
+	TINYRISCV64_INLINE u8* data_ptr(u64 addr, u64 addr_max)
+	{
+		if (data_single) [[likely]]
+			return data_regions.front().mem.data() + addr - d_beg;
+		const auto region = std::prev(std::upper_bound(data_regions.begin(), data_regions.end(), addr,
+			[](const u64 a, const DataRegion& r) { return a < r.beg; }));
+		if (addr_max >= region->end) [[unlikely]]
+			throw std::runtime_error("Memory access out of bounds");
+		if (Store && region->read_only) [[unlikely]]
+			throw std::runtime_error("Memory write to read-only data");
+		return region->mem.data() + addr - region->beg;
+	}
+
 	template<typename T>
-	inline T mem_load(u64 addr)
+	TINYRISCV64_INLINE T mem_load(u64 addr)
 	{
+		if (mem_path == Memory::Paged)
+			return pages->load<T>(addr);
 		T value;
 		memcpy(&value, mem_ptr<T>(addr), sizeof(T));
 		return value;
 	}
 
 	template<typename T>
-	inline void mem_store(u64 addr, T value)
+	TINYRISCV64_INLINE void mem_store(u64 addr, T value)
 	{
-		memcpy(mem_ptr<T>(addr), &value, sizeof(T));
+		if (addr < shared_end && addr >= p_beg) [[unlikely]]
+			throw std::runtime_error("Memory write to read-only program");
+		if (mem_path == Memory::Paged)
+			pages->store<T>(addr, value);
+		else
+			memcpy(mem_ptr<T, true>(addr), &value, sizeof(T));
+		if (addr < decoded_end) // self-modifying code, or data sharing the program image
+			invalidate_decoded(addr, sizeof(T));
 	}
 
 	// Instruction execution helpers
@@ -482,6 +3905,7 @@ protected:
 	// SYSTEM instruction dispatch (opcode 0x73)
 	inline void exec_system(u8 funct3, u8 rd)
 	{
+		const HostAccess host(*this); // for the handlers
 		if (funct3 != 0) [[unlikely]]
 		{
 			handle_csr();
@@ -501,7 +3925,7 @@ protected:
 				//   ebreak
 				//   srai zero,zero,0x7   (0x40705013)  <-- instruction after ebreak
 				// pc is already advanced past the ebreak at this point.
-				const bool has_prev = (pc >= 8) && mem_load<u32>(pc - 8) == 0x01f01013u;
+				const bool has_prev = (pc >= p_beg + 8) && mem_load<u32>(pc - 8) == 0x01f01013u;
 				const bool has_next = (pc + 3 < p_end) && mem_load<u32>(pc) == 0x40705013u;
 				if (has_prev && has_next)
 					handle_semihost();
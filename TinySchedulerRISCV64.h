@@ -0,0 +1,228 @@
+/*
+ * TinyRISCV64 extension to run many VMs cooperatively on one thread
+ *
+ * https://github.com/neilstephens/TinyRISCV64
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Neil Stephens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TINYSCHEDULERRISCV64_H
+#define TINYSCHEDULERRISCV64_H
+
+#include "TinyElfRISCV64.h"
+
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+#include <format>
+#include <memory>
+#include <map>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+
+namespace TinyRISCV64
+{
+
+// Runs many VMs on the calling thread, each for a quantum of instructions at a time (see VM::run())
+//   the highest priority ready VM runs next, round-robin within a priority; an ElfVM reading an
+//   empty Pipe is parked until the pipe is fed or closed, from whichever thread does that
+class Scheduler
+{
+public:
+	using Id = size_t;
+
+	enum class State : u8
+	{
+		Ready,   // Waiting for its next quantum
+		Parked,  // Waiting for input (see ElfVM::blocked_on())
+		Halted,  // Finished (see RunStatus::Halted)
+		Trapped  // Faulted (see VM::trap_reason())
+	};
+
+	explicit Scheduler(const size_t quantum = 10000) : quantum(quantum)
+	{
+		if (!quantum)
+			throw std::invalid_argument("Scheduler quantum must be at least 1 instruction");
+	}
+
+	// Take a VM to run from entry_point, with its own quantum if one is given; returns its id
+	//   a higher priority VM always runs first while it's ready
+	Id add(std::unique_ptr<VM> vm, const u64 entry_point, const int priority = 0, const size_t vm_quantum = 0)
+	{
+		if (!vm)
+			throw std::invalid_argument("Scheduler needs a VM");
+		vm->start_program(entry_point);
+		const Id id = next_id++;
+		tasks.emplace(id, Task{std::move(vm), priority, vm_quantum ? vm_quantum : quantum, State::Ready});
+		ready[priority].push_back(id);
+		return id;
+	}
+
+	// Give back a VM, to inspect or reuse; it's no longer scheduled
+	std::unique_ptr<VM> remove(const Id id)
+	{
+		auto& task = find(id);
+		if (task.state == State::Ready)
+		{
+			auto& queue = ready[task.priority];
+			std::erase(queue, id);
+			if (queue.empty())
+				ready.erase(task.priority);
+		}
+		else if (task.state == State::Parked)
+			--parked;
+		auto vm = std::move(task.vm);
+		tasks.erase(id);
+		return vm;
+	}
+
+	VM& vm(const Id id) { return *find(id).vm; }
+	State state(const Id id) { return find(id).state; }
+	size_t size() const { return tasks.size(); }
+	size_t parked_count() const { return parked; }
+
+	// Run one quantum of the next ready VM; false if none is ready
+	bool step()
+	{
+		wake_parked();
+		if (ready.empty())
+			return false;
+		const auto first = ready.begin();
+		const int priority = first->first;
+		const Id id = first->second.front();
+		first->second.pop_front();
+		if (first->second.empty())
+			ready.erase(first);
+
+		auto& task = tasks.at(id);
+		switch (task.vm->run(task.quantum))
+		{
+			case RunStatus::Halted:
+				task.state = State::Halted;
+				break;
+			case RunStatus::Trap:
+				task.state = State::Trapped;
+				break;
+			case RunStatus::Yield:
+				if (auto* elf = dynamic_cast<ElfVM*>(task.vm.get()); elf && elf->blocked_on())
+				{
+					task.state = State::Parked;
+					++parked;
+					if (!elf->blocked_on()->when_readable([wakes = wakes, id] { wakes->push(id); }))
+						wakes->push(id); // fed since the read
+					break;
+				}
+				[[fallthrough]];
+			default:
+				ready[priority].push_back(id);
+				break;
+		}
+		return true;
+	}
+
+	// Run until no VM is ready, and return how many are parked
+	//   with wait set, wait for input to wake parked VMs instead, until they have all halted or trapped
+	size_t run(const bool wait = false)
+	{
+		for (;;)
+		{
+			while (step()) {}
+			if (!wait || !parked)
+				return parked;
+			wakes->wait();
+		}
+	}
+
+private:
+	struct Task
+	{
+		std::unique_ptr<VM> vm;
+		int priority;
+		size_t quantum;
+		State state;
+	};
+
+	// Ids of parked VMs whose pipes became readable, pushed from the threads feeding them
+	class Wakes
+	{
+	public:
+		void push(const Id id)
+		{
+			{
+				std::lock_guard lock(mutex);
+				ids.push_back(id);
+			}
+			cv.notify_one();
+		}
+		std::vector<Id> take()
+		{
+			std::lock_guard lock(mutex);
+			return std::exchange(ids, {});
+		}
+		void wait()
+		{
+			std::unique_lock lock(mutex);
+			cv.wait(lock, [this] { return !ids.empty(); });
+		}
+	private:
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::vector<Id> ids;
+	};
+
+	Task& find(const Id id)
+	{
+		const auto it = tasks.find(id);
+		if (it == tasks.end())
+			throw std::invalid_argument(std::format("No VM with id {} in the scheduler", id));
+		return it->second;
+	}
+
+	// Queue the VMs woken since the last step (ignoring any removed since they parked)
+	void wake_parked()
+	{
+		for (const Id id : wakes->take())
+		{
+			const auto it = tasks.find(id);
+			if (it == tasks.end() || it->second.state != State::Parked)
+				continue;
+			it->second.state = State::Ready;
+			--parked;
+			ready[it->second.priority].push_back(id);
+		}
+	}
+
+	const size_t quantum;
+	std::unordered_map<Id, Task> tasks;
+	std::map<int, std::deque<Id>, std::greater<int>> ready; // By priority, highest first
+	size_t parked = 0;
+	Id next_id = 0;
+	std::shared_ptr<Wakes> wakes = std::make_shared<Wakes>(); // Outlives the scheduler in pipes' callbacks
+};
+
+} // namespace TinyRISCV64
+
+#endif // TINYSCHEDULERRISCV64_H